@@ -0,0 +1,220 @@
+/// @file agingqueue.h
+///
+/// Priority queue with aging: the longer an element waits, the better its
+/// effective priority, so low-priority work cannot starve.
+
+// Description: an element of priority p enqueued at time e has effective
+// priority p - (now - e) / rate at time now: it gains one priority level
+// for every rate ticks it waits.  Ordering by that value at any one time
+// is the same as ordering by the fixed key p * rate + e, because the
+// now / rate term is common to every element, so nothing has to be
+// revisited as time passes.
+//
+// Within one priority level the keys grow with e, so each level is a
+// plain FIFO and only its oldest element can be the next one out.
+// aging_prqueue therefore keeps one FIFO bucket per level and a prqueue
+// holding just the level heads, keyed by the head's key.  Enqueue appends
+// to a bucket in O(1) (plus O(logP) when the bucket was empty, for P
+// levels in use); dequeue pops the best head and re-keys its level with
+// the next element.  Keeping all elements in one tree instead would feed
+// it nearly sorted keys and let it degenerate into a list.
+//
+// Time is a logical clock that advances by one tick per dequeue, i.e.
+// residency is measured in elements served, and advance() lets callers
+// add ticks of their own (e.g. to follow a real clock).  Keys are stored
+// relative to a base time so they fit in an int; once the clock runs 2^30
+// ticks past the base, the heads are re-keyed in an O(P logP) rebase.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "prqueue.h"
+
+using namespace std;
+
+template<typename T>
+class aging_prqueue {
+public:
+    // Keys hold at most this many ticks of enqueue time past the base.
+    static const int64_t REBASE_AT = 1 << 30;
+
+private:
+    struct ITEM {
+        T value;
+        int64_t enqueued; // clock at enqueue
+    };
+
+    unordered_map<int, deque<ITEM>> levels;  // FIFO bucket per non-empty priority
+    prqueue<int> heads;  // priority of every non-empty level, keyed by its head
+    int sz;
+    int rate;         // ticks of waiting worth one priority level
+    int64_t clock;    // ticks so far
+    int64_t base;     // clock value that keys are relative to
+
+    // The fixed key of an element.  A wait beyond REBASE_AT / 2 ticks
+    // before the base (only possible across a rebase) counts as exactly
+    // that long.
+    int _key(int priority, int64_t enqueued) const {
+        int64_t since = enqueued - base;
+        if (since < 0) {
+            since = 0;
+        }
+        return (int) ((int64_t) priority * rate + since);
+    }
+
+public:
+    //
+    // constructor:
+    //
+    // An empty queue whose elements gain one priority level per rate ticks
+    // of waiting (rate >= 1).  priority * rate must stay within +-2^30.
+    // O(1)
+    //
+    explicit aging_prqueue(int agingRate = 1000) {
+        rate = agingRate < 1 ? 1 : agingRate;
+        sz = 0;
+        clock = 0;
+        base = 0;
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value behind elements of the same effective priority.
+    // O(1) amortized, plus O(logP) if its level was empty
+    //
+    void enqueue(T value, int priority) {
+        if (clock - base >= REBASE_AT) {
+            rebase();
+        }
+        deque<ITEM>& level = levels[priority];
+        level.push_back(ITEM{move(value), clock});
+        if (level.size() == 1) {
+            heads.enqueue(priority, _key(priority, clock));
+        }
+        sz++;
+    }
+
+
+    //
+    // dequeue / try_dequeue:
+    //
+    // Remove the element with the best effective priority, then advance
+    // the clock by one tick.  waited, when given, receives the element's
+    // residency in ticks.  dequeue returns T{} and try_dequeue an empty
+    // optional when the queue is empty (the clock does not advance).
+    // O(logP)
+    //
+    T dequeue(int64_t* waited = nullptr) {
+        optional<T> value = try_dequeue(waited);
+        return value ? move(*value) : T{};
+    }
+
+    optional<T> try_dequeue(int64_t* waited = nullptr) {
+        optional<int> priority = heads.try_dequeue();
+        if (!priority) {
+            return nullopt;
+        }
+        auto level = levels.find(*priority);
+        deque<ITEM>& items = level->second;
+        optional<T> value(move(items.front().value));
+        if (waited != nullptr) {
+            *waited = clock - items.front().enqueued;
+        }
+        items.pop_front();
+        if (!items.empty()) {
+            heads.enqueue(*priority, _key(*priority, items.front().enqueued));
+        } else {
+            levels.erase(level);  // only levels in use are kept
+        }
+        sz--;
+        clock++;
+        return value;
+    }
+
+
+    //
+    // peek_priority:
+    //
+    // The priority given to enqueue of the next element.
+    // O(logP)
+    //
+    bool peek_priority(int& priority) {
+        const int* head = heads.peek_ref();
+        if (head == nullptr) {
+            return false;
+        }
+        priority = *head;
+        return true;
+    }
+
+
+    //
+    // advance / now:
+    //
+    // Adds ticks to the clock, and reads it.
+    // O(1)
+    //
+    void advance(int64_t ticks) {
+        clock += ticks < 0 ? 0 : ticks;
+    }
+
+    int64_t now() const {
+        return clock;
+    }
+
+
+    //
+    // rebase:
+    //
+    // Moves the key base up to the oldest element (or to now when empty)
+    // and re-keys the level heads.  Called automatically when due.  The
+    // order of the elements does not change, except that waits beyond
+    // REBASE_AT / 2 ticks are cut to that length.
+    // O(P logP)
+    //
+    void rebase() {
+        vector<int> priorities;
+        optional<int> priority;
+        while ((priority = heads.try_dequeue())) {
+            priorities.push_back(*priority);
+        }
+        int64_t oldest = clock;
+        for (int p : priorities) {
+            int64_t e = levels.find(p)->second.front().enqueued;
+            oldest = e < oldest ? e : oldest;
+        }
+        base = oldest > clock - REBASE_AT / 2 ? oldest : clock - REBASE_AT / 2;
+        for (int p : priorities) {
+            heads.enqueue(p, _key(p, levels.find(p)->second.front().enqueued));
+        }
+    }
+
+
+    //
+    // size:
+    //
+    // O(1)
+    //
+    int size() const {
+        return sz;
+    }
+
+
+    //
+    // level_count:
+    //
+    // The # of priority levels with waiting elements (P above).
+    // O(1)
+    //
+    int level_count() const {
+        return (int) levels.size();
+    }
+};
@@ -0,0 +1,270 @@
+/// @file arena.h
+///
+/// NUMA-aware, optionally hugepage-backed fixed-size block allocator for
+/// queue nodes.
+
+// Description: node_arena hands out blocks of one size carved from large
+// chunks obtained with mmap.  An arena created for a NUMA node binds each
+// chunk to that node with mbind (called through syscall, so neither libnuma
+// nor its headers are needed) before any page is touched.  When there is no
+// NUMA support, the binding is refused, or no node is given, the chunk is
+// left to the kernel's first-touch policy: its pages land on the node of
+// the thread that first writes them, which for a queue fed by threads of
+// one socket is that socket.  Blocks are only returned to the system when
+// the arena is destroyed; freed blocks are kept on a free list for reuse.
+// Allocation is thread safe, so an arena may be shared by several queues.
+//
+// With hugePages, each chunk is one 2 MB huge page, so a tree of tens of
+// millions of nodes needs a few thousand TLB entries instead of a few
+// hundred thousand and a descent stops missing the TLB at every level.
+// An explicit huge page (MAP_HUGETLB) is tried first; it needs pages
+// reserved in /proc/sys/vm/nr_hugepages.  Otherwise the chunk is mapped
+// 2 MB aligned and marked MADV_HUGEPAGE, so that transparent huge pages
+// back it whenever THP is enabled ("always" or "madvise").  If neither is
+// available the chunk simply uses normal pages.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+class node_arena {
+public:
+    static const size_t CHUNK_SIZE = 2 << 20;   // also the huge page size
+
+    // How the chunks are backed, from weakest to strongest.
+    enum page_backing { SMALL_PAGES, TRANSPARENT_HUGE_PAGES, EXPLICIT_HUGE_PAGES };
+
+private:
+    // Memory policy of mbind(2); see <numaif.h>.
+    static const int MPOL_PREFERRED_ = 1;
+    static const int MAX_NODES = 1024;
+
+    struct FREE {
+        FREE* next;
+    };
+
+    size_t blockSize;
+    int node;             // NUMA node to bind chunks to, -1 for first touch
+    bool bindOk;          // every chunk so far was bound to node
+    bool huge;            // back chunks with huge pages
+
+    mutex lock;           // guards everything below
+    vector<void*> chunks;
+    char* bump;           // next unused block in the newest chunk
+    char* bumpEnd;
+    FREE* freeBlocks;
+    page_backing weakest; // weakest backing of any chunk so far
+
+    // Binds [addr, addr + len) to node.  Fails (harmlessly) when the
+    // kernel has no NUMA support or the process may not set a policy.
+    bool _bind(void* addr, size_t len) const {
+        if (node < 0 || node >= MAX_NODES) {
+            return false;
+        }
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {};
+        mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        return syscall(SYS_mbind, addr, len, MPOL_PREFERRED_, mask, (unsigned long) MAX_NODES,
+                       0) == 0;
+    }
+
+    // Maps a chunk backed as well as huge allows, recording the backing in
+    // weakest.  Caller holds lock.
+    void* _map() {
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (!huge) {
+            void* chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+            return chunk == MAP_FAILED ? nullptr : chunk;
+        }
+        void* chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (chunk != MAP_FAILED) {
+            return chunk;
+        }
+
+        // Map twice the size and trim it to an aligned chunk: THP only
+        // backs 2 MB aligned ranges.
+        char* span = (char*) mmap(nullptr, 2 * CHUNK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (span == (char*) MAP_FAILED) {
+            return nullptr;
+        }
+        uintptr_t mask = CHUNK_SIZE - 1;
+        char* aligned = (char*) (((uintptr_t) span + mask) & ~mask);
+        if (aligned > span) {
+            munmap(span, aligned - span);
+        }
+        if (span + 2 * CHUNK_SIZE > aligned + CHUNK_SIZE) {
+            munmap(aligned + CHUNK_SIZE, span + 2 * CHUNK_SIZE - (aligned + CHUNK_SIZE));
+        }
+        bool thp = madvise(aligned, CHUNK_SIZE, MADV_HUGEPAGE) == 0;
+        if (!thp) {
+            weakest = SMALL_PAGES;
+        } else if (weakest == EXPLICIT_HUGE_PAGES) {
+            weakest = TRANSPARENT_HUGE_PAGES;
+        }
+        return aligned;
+    }
+
+    // Maps a new chunk and makes it the bump region.  Caller holds lock.
+    bool _grow() {
+        void* chunk = _map();
+        if (chunk == nullptr) {
+            return false;
+        }
+        if (node >= 0 && !_bind(chunk, CHUNK_SIZE)) {
+            bindOk = false;
+        }
+        chunks.push_back(chunk);
+        bump = (char*) chunk;
+        bumpEnd = bump + CHUNK_SIZE / blockSize * blockSize;
+        return true;
+    }
+
+public:
+    //
+    // constructor:
+    //
+    // An arena of blocks of at least size bytes, aligned for any type, with
+    // chunks bound to NUMA node numaNode (-1: first touch) and backed by
+    // huge pages when hugePages is set and the system allows it.  No
+    // memory is mapped until the first allocation.
+    //
+    explicit node_arena(size_t size, int numaNode = -1, bool hugePages = false) {
+        size_t align = alignof(max_align_t);
+        blockSize = ((size < sizeof(FREE) ? sizeof(FREE) : size) + align - 1) / align * align;
+        node = numaNode;
+        bindOk = numaNode >= 0;
+        huge = hugePages;
+        bump = bumpEnd = nullptr;
+        freeBlocks = nullptr;
+        weakest = hugePages ? EXPLICIT_HUGE_PAGES : SMALL_PAGES;
+    }
+
+    node_arena(const node_arena&) = delete;
+    node_arena& operator=(const node_arena&) = delete;
+
+    // Every block must have been deallocated or abandoned by its user.
+    ~node_arena() {
+        for (void* chunk : chunks) {
+            munmap(chunk, CHUNK_SIZE);
+        }
+    }
+
+
+    //
+    // allocate / deallocate:
+    //
+    // An uninitialized block, reusing a freed one when there is one;
+    // deallocate makes a block from this arena available again.  allocate
+    // throws bad_alloc when no chunk can be mapped.
+    // O(1)
+    //
+    void* allocate() {
+        lock_guard<mutex> guard(lock);
+        if (freeBlocks != nullptr) {
+            FREE* block = freeBlocks;
+            freeBlocks = block->next;
+            return block;
+        }
+        if (bump == bumpEnd && !_grow()) {
+            throw bad_alloc();
+        }
+        void* block = bump;
+        bump += blockSize;
+        return block;
+    }
+
+    void deallocate(void* block) {
+        lock_guard<mutex> guard(lock);
+        FREE* f = (FREE*) block;
+        f->next = freeBlocks;
+        freeBlocks = f;
+    }
+
+
+    //
+    // block_size / numa_node / bound / reserved:
+    //
+    // The block size, the node asked for, whether every chunk so far was
+    // bound to it (false when first touch is in effect), and the bytes
+    // mapped.
+    // O(1)
+    //
+    size_t block_size() const {
+        return blockSize;
+    }
+
+    int numa_node() const {
+        return node;
+    }
+
+    bool bound() {
+        lock_guard<mutex> guard(lock);
+        return bindOk && !chunks.empty();
+    }
+
+    size_t reserved() {
+        lock_guard<mutex> guard(lock);
+        return chunks.size() * CHUNK_SIZE;
+    }
+
+
+    //
+    // backing:
+    //
+    // The weakest page backing of any chunk mapped so far.  For
+    // TRANSPARENT_HUGE_PAGES the kernel was asked for huge pages, which it
+    // grants when THP is enabled and it finds free 2 MB frames.
+    // O(1)
+    //
+    page_backing backing() {
+        lock_guard<mutex> guard(lock);
+        return weakest;
+    }
+
+
+    //
+    // numa_nodes / current_node:
+    //
+    // # of NUMA nodes of the machine (1 without NUMA support) and the node
+    // of the CPU the calling thread runs on (0 when unknown).  getcpu goes
+    // through the vDSO, so current_node costs no system call.
+    //
+    static int numa_nodes() {
+        static const int count = []() {
+            int n = 0;
+            if (DIR* dir = opendir("/sys/devices/system/node")) {
+                while (dirent* entry = readdir(dir)) {
+                    string name = entry->d_name;
+                    if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                        name.find_first_not_of("0123456789", 4) == string::npos) {
+                        n++;
+                    }
+                }
+                closedir(dir);
+            }
+            return n == 0 ? 1 : n;
+        }();
+        return count;
+    }
+
+    static int current_node() {
+        unsigned cpu = 0;
+        unsigned numaNode = 0;
+        if (getcpu(&cpu, &numaNode) != 0) {
+            return 0;
+        }
+        return (int) numaNode;
+    }
+};
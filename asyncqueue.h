@@ -0,0 +1,270 @@
+/// @file asyncqueue.h
+///
+/// C++20 coroutine interface to prqueue: consumers co_await an element
+/// instead of blocking a thread.
+
+// Description: async_prqueue pairs a prqueue of elements with a prqueue of
+// suspended consumers.  co_await q.async_dequeue(waiterPriority) completes
+// at once when an element is queued; otherwise the consumer's coroutine is
+// suspended and queued by its waiterPriority (FIFO among equals).  enqueue
+// hands the element straight to the best waiting consumer and schedules its
+// resumption on an async_executor, so elements never sit in the queue
+// while someone waits for one, and a burst of enqueues resumes the waiters
+// in priority order without recursing into them.  A suspended consumer
+// costs its coroutine frame plus one waiter node, so hundreds of thousands
+// of them fit where as many blocked threads would not.
+//
+// Everything here is single-threaded: the queue, its consumers and the
+// executor belong to the one thread that calls async_executor::run.
+
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "prqueue.h"
+
+using namespace std;
+
+//
+// async_task:
+//
+// Fire-and-forget coroutine return type.  The coroutine starts suspended
+// and runs once handed to async_executor::spawn; its frame is freed when
+// it finishes.
+//
+class async_task {
+public:
+    struct promise_type {
+        async_task get_return_object() {
+            return async_task(coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            terminate();
+        }
+    };
+
+private:
+    coroutine_handle<promise_type> handle;
+
+    friend class async_executor;
+
+    explicit async_task(coroutine_handle<promise_type> h) : handle(h) {}
+
+public:
+    async_task(async_task&& other) noexcept : handle(exchange(other.handle, nullptr)) {}
+
+    async_task(const async_task&) = delete;
+    async_task& operator=(const async_task&) = delete;
+    async_task& operator=(async_task&&) = delete;
+
+    // A task that was never spawned is destroyed unstarted.
+    ~async_task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+};
+
+
+//
+// async_executor:
+//
+// Single-threaded run queue of coroutines ready to resume.
+//
+class async_executor {
+private:
+    deque<coroutine_handle<>> ready;
+
+public:
+    async_executor() = default;
+    async_executor(const async_executor&) = delete;
+    async_executor& operator=(const async_executor&) = delete;
+
+    // Coroutines still waiting to run are destroyed unstarted.
+    ~async_executor() {
+        for (coroutine_handle<> h : ready) {
+            h.destroy();
+        }
+    }
+
+
+    //
+    // spawn / schedule:
+    //
+    // Queue a new task, or a suspended coroutine, to be resumed by run.
+    // O(1)
+    //
+    void spawn(async_task task) {
+        schedule(exchange(task.handle, nullptr));
+    }
+
+    void schedule(coroutine_handle<> h) {
+        ready.push_back(h);
+    }
+
+
+    //
+    // run:
+    //
+    // Resumes ready coroutines, in the order they were scheduled, until
+    // none is left; coroutines scheduled meanwhile run too.  Returns the
+    // # of resumptions.
+    // O(resumptions)
+    //
+    size_t run() {
+        size_t resumed = 0;
+        while (!ready.empty()) {
+            coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+            resumed++;
+        }
+        return resumed;
+    }
+
+
+    //
+    // pending:
+    //
+    // # of coroutines waiting to be resumed.
+    // O(1)
+    //
+    size_t pending() const {
+        return ready.size();
+    }
+};
+
+
+template<typename T>
+class async_prqueue {
+public:
+    class dequeue_awaiter;
+
+private:
+    async_executor& exec;
+    prqueue<T> items;
+    prqueue<dequeue_awaiter*> waiters;   // suspended consumers, by waiterPriority
+
+public:
+    //
+    // dequeue_awaiter:
+    //
+    // What async_dequeue returns; co_await it for the next element.  It
+    // lives in the awaiting coroutine's frame, which is where the element
+    // handed over by enqueue is kept until the coroutine resumes.
+    //
+    class dequeue_awaiter {
+    private:
+        async_prqueue* q;
+        int waiterPriority;
+        optional<T> value;
+        coroutine_handle<> consumer;
+
+        friend class async_prqueue;
+
+        dequeue_awaiter(async_prqueue* queue, int priority) : q(queue), waiterPriority(priority) {}
+
+    public:
+        bool await_ready() {
+            value = q->items.try_dequeue();
+            return value.has_value();
+        }
+
+        void await_suspend(coroutine_handle<> h) {
+            consumer = h;
+            q->waiters.enqueue(this, waiterPriority);
+        }
+
+        T await_resume() {
+            return move(*value);
+        }
+    };
+
+    explicit async_prqueue(async_executor& executor) : exec(executor) {}
+
+    async_prqueue(const async_prqueue&) = delete;
+    async_prqueue& operator=(const async_prqueue&) = delete;
+
+    // Consumers still suspended are destroyed, as if they were cancelled.
+    ~async_prqueue() {
+        optional<dequeue_awaiter*> w;
+        while ((w = waiters.try_dequeue())) {
+            (*w)->consumer.destroy();
+        }
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Hands the value to the waiting consumer with the best waiterPriority
+    // and schedules it on the executor, or queues the value by priority if
+    // no consumer waits.
+    // O(logw) with w suspended consumers, else O(logn)
+    //
+    void enqueue(T value, int priority) {
+        optional<dequeue_awaiter*> w = waiters.try_dequeue();
+        if (!w) {
+            items.enqueue(move(value), priority);
+            return;
+        }
+        (*w)->value.emplace(move(value));
+        exec.schedule((*w)->consumer);
+    }
+
+
+    //
+    // async_dequeue:
+    //
+    // co_await async_dequeue(waiterPriority) yields the next element,
+    // suspending the caller behind the consumers already waiting with a
+    // waiterPriority no worse than its own while the queue is empty.
+    // O(logn) when an element is queued, else O(logw) to suspend
+    //
+    dequeue_awaiter async_dequeue(int waiterPriority = 0) {
+        return dequeue_awaiter(this, waiterPriority);
+    }
+
+
+    //
+    // try_dequeue:
+    //
+    // The next element, if one is queued, without suspending.
+    // O(logn)
+    //
+    optional<T> try_dequeue() {
+        return items.try_dequeue();
+    }
+
+
+    //
+    // size / waiting:
+    //
+    // # of queued elements and of suspended consumers.  At most one of the
+    // two is non-zero.
+    // O(1)
+    //
+    int size() {
+        return items.size();
+    }
+
+    int waiting() {
+        return waiters.size();
+    }
+};
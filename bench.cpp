@@ -0,0 +1,1025 @@
+/// @file bench.cpp
+///
+/// Benchmarks for prqueue and the components built on top of it.
+
+// Usage: ./bench.exe [name...]
+// Runs every benchmark, or only the ones named on the command line.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <execution>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "agingqueue.h"
+#include "arena.h"
+#include "asyncqueue.h"
+#include "inlinetask.h"
+#include "numaqueue.h"
+#include "pairingheap.h"
+#include "persistentqueue.h"
+#include "prqueue.h"
+#include "prqueue_parallel.h"
+#include "rcuqueue.h"
+#include "splayqueue.h"
+#include "workstealing.h"
+
+using namespace std;
+
+// Every heap allocation made by the benchmarks, so they can report
+// allocations per item.  The replacements are kept out of line so that GCC
+// does not pair the inlined free() with the new-expression and warn.
+static atomic<long> heapAllocs(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    heapAllocs.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// Seconds elapsed since start.
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Thread counts to sweep: 1, 2, 4, ... up to the hardware concurrency.
+static vector<size_t> threadCounts() {
+    size_t hw = thread::hardware_concurrency();
+    vector<size_t> counts;
+    for (size_t n = 1; n < hw; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(hw == 0 ? 1 : hw);
+    return counts;
+}
+
+
+// dTLB load misses of the calling thread in user space, counted through
+// perf_event_open.  valid() is false when the kernel or hypervisor exposes
+// no such counter or perf_event_paranoid forbids it.
+class DTLB_COUNTER {
+private:
+    int fd;
+
+public:
+    DTLB_COUNTER() {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    DTLB_COUNTER(const DTLB_COUNTER&) = delete;
+    DTLB_COUNTER& operator=(const DTLB_COUNTER&) = delete;
+
+    ~DTLB_COUNTER() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool valid() const {
+        return fd >= 0;
+    }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // Misses since start(), or -1 when there is no counter.
+    long stop() {
+        long count = 0;
+        if (fd < 0) {
+            return -1;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != (ssize_t) sizeof(count)) {
+            return -1;
+        }
+        return count;
+    }
+};
+
+// Formats a counter value for a table column, "n/a" when unavailable.
+static string countText(long count) {
+    return count < 0 ? "n/a" : to_string(count);
+}
+
+// Anonymous memory of this process currently backed by transparent huge
+// pages, in kB.
+static long anonHugeKb() {
+    ifstream in("/proc/self/smaps_rollup");
+    string key;
+    long kb = 0;
+    while (in >> key) {
+        if (key == "AnonHugePages:") {
+            in >> kb;
+            return kb;
+        }
+        in.ignore(1 << 16, '\n');
+    }
+    return 0;
+}
+
+
+//
+// forkjoin:
+//
+// Binary fork-join tree of depth 16 on ws_scheduler; every leaf burns a
+// fixed amount of work.  Deeper tasks get better priorities so leaves run
+// before new forks, keeping the queues short.
+//
+static atomic<long> forkjoinLeaves;
+
+static void forkjoinTask(ws_scheduler& sched, int depth) {
+    if (depth == 0) {
+        volatile unsigned x = 0;
+        for (int i = 0; i < 2000; i++) {
+            x = x * 31 + i;
+        }
+        forkjoinLeaves.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    for (int child = 0; child < 2; child++) {
+        sched.spawn([&sched, depth]() { forkjoinTask(sched, depth - 1); }, depth - 1);
+    }
+}
+
+static void benchForkjoin() {
+    const int depth = 16;
+    double base = 0;
+    printf("forkjoin: depth %d (%d leaves)\n", depth, 1 << depth);
+    printf("  %8s %10s %8s %8s\n", "threads", "seconds", "speedup", "steals");
+    for (size_t n : threadCounts()) {
+        forkjoinLeaves = 0;
+        auto start = chrono::steady_clock::now();
+        size_t steals;
+        {
+            ws_scheduler sched(n);
+            sched.spawn([&sched]() { forkjoinTask(sched, depth); }, depth);
+            sched.wait();
+            steals = sched.steals();
+        }
+        double secs = secondsSince(start);
+        if (base == 0) {
+            base = secs;
+        }
+        printf("  %8zu %10.4f %8.2f %8zu\n", n, secs, base / secs, steals);
+        if (forkjoinLeaves != (1 << depth)) {
+            printf("  ERROR: ran %ld leaves\n", forkjoinLeaves.load());
+        }
+    }
+}
+
+
+//
+// hugepages:
+//
+// Builds a 4M-element prqueue from random priorities, then runs 2M
+// dequeue/enqueue pairs, with nodes from the heap, from a node_arena on
+// normal pages and from a node_arena on huge pages.  The tree (about
+// 300 MB) is far beyond what the TLB covers with 4 KB pages, so every
+// level of a descent risks a page walk.  dTLB load misses are read from
+// the PMU and reported as n/a when no counter is available.
+//
+static void hugepagesRun(const char* name, node_arena* arena) {
+    const int n = 4000000;
+    const int pairs = 2000000;
+    DTLB_COUNTER tlb;
+    long hugeBefore = anonHugeKb();
+    prqueue<int> pq;
+    pq.set_arena(arena);
+    mt19937 rng(19);
+
+    tlb.start();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, (int) (rng() % 1000000000));
+    }
+    double buildSecs = secondsSince(start);
+    long buildMisses = tlb.stop();
+
+    long sum = 0;
+    tlb.start();
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < pairs; i++) {
+        sum += pq.dequeue();
+        pq.enqueue(i, (int) (rng() % 1000000000));
+    }
+    double pairSecs = secondsSince(start);
+    long pairMisses = tlb.stop();
+
+    printf("  %-16s %9.3f %14s %9.3f %14s %10ld\n", name, buildSecs,
+           countText(buildMisses).c_str(), pairSecs, countText(pairMisses).c_str(),
+           (anonHugeKb() - hugeBefore) / 1024);
+    if (sum == 0) {
+        printf("  (checksum 0)\n");
+    }
+}
+
+static void benchHugepages() {
+    printf("hugepages: 4M-element build, then 2M dequeue/enqueue pairs\n");
+    printf("  %-16s %9s %14s %9s %14s %10s\n", "nodes", "build s", "build dTLB", "pairs s",
+           "pairs dTLB", "THP MB");
+    hugepagesRun("heap", nullptr);
+    {
+        node_arena arena(prqueue<int>::NODE_SIZE);
+        hugepagesRun("arena, 4K pages", &arena);
+    }
+    node_arena arena(prqueue<int>::NODE_SIZE, -1, true);
+    hugepagesRun("arena, huge", &arena);
+    const char* backing[] = {"normal pages", "transparent huge pages", "explicit huge pages"};
+    printf("  huge arena backing: %s\n", backing[arena.backing()]);
+}
+
+
+//
+// mixed:
+//
+// Random enqueue/peek/dequeue mix on a single prqueue.  Built with
+// "make benchstats" the queue's counters and latency histograms are dumped
+// after the run.
+//
+static void benchMixed() {
+    const int ops = 1000000;
+    prqueue<int> pq;
+    mt19937 rng(42);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < ops; i++) {
+        unsigned r = rng();
+        if (r % 3 != 0 || pq.size() == 0) {
+            pq.enqueue(i, (int) (r % 100000));
+        } else if (r % 2 == 0) {
+            pq.peek();
+        } else {
+            pq.dequeue();
+        }
+    }
+    printf("mixed: %d ops in %.4f s, %d left\n", ops, secondsSince(start), pq.size());
+#ifdef PRQUEUE_STATS
+    pq.stats().print(cout);
+#endif
+}
+
+
+//
+// numa:
+//
+// Enqueue then dequeue 1M elements on a prqueue whose nodes come from the
+// heap and from a node_arena bound to the current NUMA node, then
+// enqueue/dequeue pairs on numa_prqueue from every thread count.  On a
+// single-node machine the second part only measures the overhead of the
+// per-socket layer.
+//
+static double numaArenaRun(node_arena* arena) {
+    const int n = 1000000;
+    prqueue<int> pq;
+    pq.set_arena(arena);
+    mt19937 rng(3);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, (int) (rng() % 1000000));
+    }
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += pq.dequeue();
+    }
+    double secs = secondsSince(start);
+    if (sum != (long) n * (n - 1) / 2) {
+        printf("  ERROR: checksum %ld\n", sum);
+    }
+    return secs;
+}
+
+static void benchNuma() {
+    node_arena arena(prqueue<int>::NODE_SIZE, node_arena::current_node());
+    double heapSecs = numaArenaRun(nullptr);
+    double arenaSecs = numaArenaRun(&arena);
+    printf("numa: %d node(s), arena on node %d %s\n", node_arena::numa_nodes(), arena.numa_node(),
+           arena.bound() ? "(bound)" : "(first touch)");
+    printf("  %-24s %10.4f s\n", "prqueue, heap nodes", heapSecs);
+    printf("  %-24s %10.4f s\n", "prqueue, arena nodes", arenaSecs);
+
+    const int pairs = 200000;
+    printf("  %8s %10s %14s %8s\n", "threads", "seconds", "pairs/s", "steals");
+    for (size_t t : threadCounts()) {
+        numa_prqueue<int> nq;
+        vector<thread> workers;
+        auto start = chrono::steady_clock::now();
+        for (size_t w = 0; w < t; w++) {
+            workers.emplace_back([&nq, w]() {
+                minstd_rand rng((unsigned) w + 1);
+                int value;
+                int priority;
+                for (int i = 0; i < pairs; i++) {
+                    nq.enqueue(i, (int) (rng() % 100000));
+                    nq.dequeue(value, priority);
+                }
+            });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        double secs = secondsSince(start);
+        printf("  %8zu %10.4f %14.0f %8ld\n", t, secs, t * pairs / secs, nq.steals());
+    }
+}
+
+
+//
+// parallel:
+//
+// Sequential vs parallel bulk build, structural copy and for_each over
+// 2M elements.  Speedups are relative to the execution::seq run.
+//
+static void benchParallel() {
+    const int n = 2000000;
+    vector<pair<int, int>> items;
+    mt19937 rng(7);
+    for (int i = 0; i < n; i++) {
+        items.push_back({i, (int) (rng() % (n / 4))});
+    }
+
+    printf("parallel: %d elements, %u hardware threads\n", n, thread::hardware_concurrency());
+    printf("  %-10s %10s %10s %8s\n", "operation", "seq s", "par s", "speedup");
+
+    prqueue<int> seqQ;
+    prqueue<int> parQ;
+    auto start = chrono::steady_clock::now();
+    seqQ.assign(execution::seq, items.begin(), items.end());
+    double seqSecs = secondsSince(start);
+    start = chrono::steady_clock::now();
+    parQ.assign(execution::par, items.begin(), items.end());
+    double parSecs = secondsSince(start);
+    printf("  %-10s %10.4f %10.4f %8.2f\n", "build", seqSecs, parSecs, seqSecs / parSecs);
+
+    prqueue<int> copy;
+    start = chrono::steady_clock::now();
+    copy.assign(execution::seq, seqQ);
+    seqSecs = secondsSince(start);
+    start = chrono::steady_clock::now();
+    copy.assign(execution::par, seqQ);
+    parSecs = secondsSince(start);
+    printf("  %-10s %10.4f %10.4f %8.2f\n", "copy", seqSecs, parSecs, seqSecs / parSecs);
+
+    atomic<long> total(0);
+    auto visit = [&total](const int& value, int priority) {
+        static thread_local long acc = 0;
+        unsigned h = (unsigned) value;
+        for (int i = 0; i < 16; i++) {
+            h = h * 2654435761u + (unsigned) priority;
+        }
+        acc += h & 1;
+        if ((value & 0xffff) == 0) {
+            total.fetch_add(acc, memory_order_relaxed);
+            acc = 0;
+        }
+    };
+    start = chrono::steady_clock::now();
+    seqQ.for_each(execution::seq, visit);
+    seqSecs = secondsSince(start);
+    start = chrono::steady_clock::now();
+    seqQ.for_each(execution::par, visit);
+    parSecs = secondsSince(start);
+    printf("  %-10s %10.4f %10.4f %8.2f\n", "for_each", seqSecs, parSecs, seqSecs / parSecs);
+}
+
+
+//
+// tasks:
+//
+// Enqueue, dequeue and run 1M closures with a 40-byte capture through
+// prqueue<std::function<void()>> and through task_queue (inline_task).
+// The capture is too large for std::function's small buffer, so it needs
+// a second allocation per item that inline_task avoids.  Each queue runs
+// three rounds: the first allocates its nodes, the later ones reuse them
+// from the queue's free list, as a long-lived task queue would.
+//
+template<typename Queue, typename Task>
+static void benchTaskQueue(const char* name) {
+    const int n = 1000000;
+    Queue pq;
+    uint64_t sum = 0;
+    for (int round = 0; round < 3; round++) {
+        mt19937 rng(3);
+        long allocs = heapAllocs.load();
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            uint64_t a = rng(), b = i, c = a ^ b, d = a + b;
+            pq.enqueue(Task([&sum, a, b, c, d]() { sum += a + b + c + d; }), (int) (a % 1000));
+        }
+        double enqSecs = secondsSince(start);
+        start = chrono::steady_clock::now();
+        while (optional<Task> task = pq.try_dequeue()) {
+            (*task)();
+        }
+        double deqSecs = secondsSince(start);
+        allocs = heapAllocs.load() - allocs;
+        printf("  %-18s %6d %10.4f %10.4f %12.2f\n", name, round, enqSecs, deqSecs,
+               (double) allocs / n);
+    }
+    if (sum == 0) {
+        printf("  (checksum 0)\n");
+    }
+}
+
+static void benchTasks() {
+    printf("tasks: 1000000 closures with a 40-byte capture\n");
+    printf("  %-18s %6s %10s %10s %12s\n", "queue", "round", "enqueue s", "run s", "allocs/item");
+    benchTaskQueue<task_queue, inline_task>("task_queue");
+    benchTaskQueue<prqueue<function<void()>>, function<void()>>("prqueue<function>");
+}
+
+
+//
+// splay:
+//
+// prqueue vs splay_prqueue on 200K-element queues.  "bursty" enqueues
+// bursts of 64 elements within 256 of the current minimum and then
+// dequeues 64, so all the activity is at the left edge of the tree;
+// "uniform" draws every priority from the whole range.
+//
+template<typename Queue>
+static double splayWorkload(bool bursty) {
+    const int preload = 200000;
+    const int bursts = 20000;
+    const int burst = 64;
+    Queue pq;
+    mt19937 rng(5);
+    for (int i = 0; i < preload; i++) {
+        pq.enqueue(i, (int) (rng() % 100000000));
+    }
+    long sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int b = 0; b < bursts; b++) {
+        int low = 0;
+        pq.peek_priority(low);
+        for (int i = 0; i < burst; i++) {
+            int priority = bursty ? low + (int) (rng() % 256) : (int) (rng() % 100000000);
+            pq.enqueue(i, priority);
+        }
+        for (int i = 0; i < burst; i++) {
+            sum += pq.dequeue();
+        }
+    }
+    double secs = secondsSince(start);
+    if (sum < 0) {
+        printf("  (checksum %ld)\n", sum);
+    }
+    return secs;
+}
+
+static void benchSplay() {
+    printf("splay: 20000 bursts of 64 enqueues + 64 dequeues on 200000 elements\n");
+    printf("  %-10s %10s %10s %8s\n", "workload", "prqueue s", "splay s", "speedup");
+    for (bool bursty : {true, false}) {
+        double bst = splayWorkload<prqueue<int>>(bursty);
+        double splay = splayWorkload<splay_prqueue<int>>(bursty);
+        printf("  %-10s %10.4f %10.4f %8.2f\n", bursty ? "bursty" : "uniform", bst, splay,
+               bst / splay);
+    }
+}
+
+
+//
+// aging:
+//
+// Three job classes (priorities 0, 1, 2) arrive with probabilities 0.70,
+// 0.20 and 0.08 per tick while one job is served per tick, a sustained 98%
+// load dominated by class 0.  Under strict priority class 2 only runs when
+// the other classes leave a gap; aging_prqueue (one level per 100 ticks of
+// waiting) bounds its wait.  Reports throughput and waiting time
+// percentiles per class, in ticks.
+//
+struct AGING_JOB {
+    int cls;
+    int64_t at;   // tick of arrival
+};
+
+template<typename Queue>
+static void agingRun(const char* name, Queue& q) {
+    const int ticks = 1000000;
+    const double arrive[3] = {0.70, 0.20, 0.08};
+    vector<int64_t> waits[3];
+    mt19937 rng(37);
+    uniform_real_distribution<double> coin(0.0, 1.0);
+    auto start = chrono::steady_clock::now();
+    for (int64_t tick = 0; tick < ticks; tick++) {
+        for (int cls = 0; cls < 3; cls++) {
+            if (coin(rng) < arrive[cls]) {
+                q.enqueue(AGING_JOB{cls, tick}, cls);
+            }
+        }
+        optional<AGING_JOB> job = q.try_dequeue();
+        if (job) {
+            waits[job->cls].push_back(tick - job->at);
+        }
+    }
+    double secs = secondsSince(start);
+    for (int cls = 0; cls < 3; cls++) {
+        vector<int64_t>& w = waits[cls];
+        auto pct = [&w](double p) -> int64_t {
+            if (w.empty()) {
+                return -1;
+            }
+            size_t k = (size_t) (p * (double) (w.size() - 1));
+            nth_element(w.begin(), w.begin() + k, w.end());
+            return w[k];
+        };
+        long p50 = (long) pct(0.50);
+        long p99 = (long) pct(0.99);
+        long max = w.empty() ? -1 : (long) *max_element(w.begin(), w.end());
+        printf("  %-12s %6d %10zu %10ld %10ld %10ld\n", cls == 0 ? name : "", cls, w.size(), p50,
+               p99, max);
+    }
+    printf("  %-12s %d ticks in %.3f s, %d jobs left\n", "", ticks, secs, (int) q.size());
+}
+
+static void benchAging() {
+    printf("aging: 1M ticks, 0.98 arrivals and 1 service per tick\n");
+    printf("  %-12s %6s %10s %10s %10s %10s\n", "queue", "class", "served", "p50 wait",
+           "p99 wait", "max wait");
+    prqueue<AGING_JOB> strict;
+    agingRun("strict", strict);
+    aging_prqueue<AGING_JOB> aging(100);
+    agingRun("aging", aging);
+}
+
+
+//
+// async:
+//
+// 100K consumer coroutines suspended on an async_prqueue, each taking 10
+// elements, fed 1M elements in bursts of 1000 between executor runs.
+//
+static async_task asyncBenchConsumer(async_prqueue<int>& q, int waiterPriority, long& sum) {
+    for (int i = 0; i < 10; i++) {
+        sum += co_await q.async_dequeue(waiterPriority);
+    }
+}
+
+static void benchAsync() {
+    const int consumers = 100000;
+    const int burst = 1000;
+    async_executor exec;
+    async_prqueue<int> q(exec);
+    long sum = 0;
+    long allocs = heapAllocs.load();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < consumers; i++) {
+        exec.spawn(asyncBenchConsumer(q, i % 100, sum));
+    }
+    exec.run();
+    double suspendSecs = secondsSince(start);
+    allocs = heapAllocs.load() - allocs;
+
+    start = chrono::steady_clock::now();
+    mt19937 rng(31);
+    for (int i = 0; i < 10 * consumers; i += burst) {
+        for (int j = 0; j < burst; j++) {
+            q.enqueue(i + j, (int) (rng() % 1000));
+        }
+        exec.run();
+    }
+    double feedSecs = secondsSince(start);
+    printf("async: %d consumers x 10 elements\n", consumers);
+    printf("  %-28s %10.4f s, %.1f allocations each\n", "spawn and suspend", suspendSecs,
+           (double) allocs / consumers);
+    printf("  %-28s %10.4f s, %.0f handoffs/s\n", "feed and resume", feedSecs,
+           10.0 * consumers / feedSecs);
+    if (q.waiting() != 0 || sum != 10L * consumers * (10L * consumers - 1) / 2) {
+        printf("  ERROR: %d consumers still waiting\n", q.waiting());
+    }
+}
+
+
+//
+// dijkstra:
+//
+// Single-source shortest paths over a synthetic road network: a 1000x1000
+// grid of intersections whose streets have random lengths, with every
+// 32nd row and column an arterial road four times faster.  Every backend
+// runs the same decrease-key Dijkstra; prqueue::decrease_key re-inserts
+// the element, the heaps relink it in O(1) amortized.
+//
+struct ROADS {
+    int n;
+    vector<int> first;    // CSR offsets into to/len, n + 1 entries
+    vector<int> to;
+    vector<int> len;
+};
+
+static ROADS makeRoads(int side) {
+    ROADS g;
+    g.n = side * side;
+    vector<vector<pair<int, int>>> adj(g.n);
+    mt19937 rng(11);
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            int v = y * side + x;
+            if (x + 1 < side) {
+                int w = 10 + (int) (rng() % 90);
+                w = (y % 32 == 0) ? w / 4 : w;
+                adj[v].push_back({v + 1, w});
+                adj[v + 1].push_back({v, w});
+            }
+            if (y + 1 < side) {
+                int w = 10 + (int) (rng() % 90);
+                w = (x % 32 == 0) ? w / 4 : w;
+                adj[v].push_back({v + side, w});
+                adj[v + side].push_back({v, w});
+            }
+        }
+    }
+    g.first.push_back(0);
+    for (auto& edges : adj) {
+        for (auto& [t, w] : edges) {
+            g.to.push_back(t);
+            g.len.push_back(w);
+        }
+        g.first.push_back((int) g.to.size());
+    }
+    return g;
+}
+
+template<typename Queue>
+static long dijkstra(const ROADS& g, int source, long& decreases) {
+    vector<int> dist(g.n, INT_MAX);
+    vector<typename Queue::handle> where(g.n);
+    vector<bool> done(g.n, false);
+    Queue pq;
+    dist[source] = 0;
+    where[source] = pq.enqueue(source, 0);
+    decreases = 0;
+    long total = 0;
+    while (optional<int> next = pq.try_dequeue()) {
+        int v = *next;
+        done[v] = true;
+        total += dist[v];
+        for (int e = g.first[v]; e < g.first[v + 1]; e++) {
+            int t = g.to[e];
+            int d = dist[v] + g.len[e];
+            if (done[t] || d >= dist[t]) {
+                continue;
+            }
+            if (dist[t] == INT_MAX) {
+                where[t] = pq.enqueue(t, d);
+            } else {
+                where[t] = pq.decrease_key(where[t], d);
+                decreases++;
+            }
+            dist[t] = d;
+        }
+    }
+    return total;
+}
+
+template<typename Queue>
+static void benchDijkstraWith(const ROADS& g, const char* name) {
+    long decreases;
+    auto start = chrono::steady_clock::now();
+    long total = dijkstra<Queue>(g, g.n / 2 + (int) sqrt(g.n) / 2, decreases);
+    printf("  %-18s %10.4f %12ld %16ld\n", name, secondsSince(start), decreases, total);
+}
+
+static void benchDijkstra() {
+    const int side = 1000;
+    ROADS g = makeRoads(side);
+    printf("dijkstra: %dx%d road grid, %d vertices, %zu arcs\n", side, side, g.n, g.to.size());
+    printf("  %-18s %10s %12s %16s\n", "backend", "seconds", "decrease_key", "sum of distances");
+    benchDijkstraWith<prqueue<int>>(g, "prqueue");
+    benchDijkstraWith<pairing_heap<int>>(g, "pairing_heap");
+    benchDijkstraWith<rank_pairing_heap<int>>(g, "rank_pairing_heap");
+}
+
+
+//
+// frozen:
+//
+// Random lower_bound lookups and a full in-order scan over 2M elements:
+// the prqueue pointer tree, std::lower_bound over a sorted array of the
+// distinct priorities, and the van Emde Boas index of freeze().
+//
+static void benchFrozen() {
+    const int n = 2000000;
+    const int lookups = 2000000;
+    prqueue<int> pq;
+    mt19937 rng(13);
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, (int) (rng() % (4 * n)));
+    }
+    frozen_prqueue<int> frozen = pq.freeze();
+    vector<int> keys;
+    for (auto it = frozen.begin(); it != frozen.end(); ++it) {
+        if (keys.empty() || keys.back() != it.priority()) {
+            keys.push_back(it.priority());
+        }
+    }
+    vector<int> queries;
+    for (int i = 0; i < lookups; i++) {
+        queries.push_back((int) (rng() % (4 * n)));
+    }
+
+    printf("frozen: %d elements, %zu distinct priorities, %d lookups\n", n, keys.size(), lookups);
+    printf("  %-16s %12s %10s\n", "layout", "lower_bound s", "scan s");
+    long sum = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (int q : queries) {
+        auto it = pq.lower_bound(q);
+        sum += (it == prqueue<int>::iterator()) ? 0 : *it;
+    }
+    double lookSecs = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int v : pq.range(INT_MIN, INT_MAX)) {
+        sum += v;
+    }
+    printf("  %-16s %12.4f %10.4f\n", "pointer tree", lookSecs, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    for (int q : queries) {
+        sum += lower_bound(keys.begin(), keys.end(), q) - keys.begin();
+    }
+    printf("  %-16s %12.4f %10s\n", "sorted array", secondsSince(start), "-");
+
+    start = chrono::steady_clock::now();
+    for (int q : queries) {
+        auto it = frozen.lower_bound(q);
+        sum += (it == frozen.end()) ? 0 : *it;
+    }
+    lookSecs = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int v : frozen) {
+        sum += v;
+    }
+    printf("  %-16s %12.4f %10.4f\n", "frozen vEB", lookSecs, secondsSince(start));
+    if (sum == 0) {
+        printf("  (checksum 0)\n");
+    }
+}
+
+
+//
+// snapshot:
+//
+// A 200K-element queue takes 200 snapshots for a monitor, each after 1000
+// enqueue/dequeue pairs: prqueue deep-copies itself with operator=,
+// persistent_prqueue copies one pointer and path-copies on every update.
+//
+static void benchSnapshot() {
+    const int n = 200000;
+    const int snapshots = 200;
+    const int opsPer = 1000;
+    printf("snapshot: %d elements, %d snapshots, %d op pairs between them\n", n, snapshots, opsPer);
+    printf("  %-20s %10s %12s %14s\n", "queue", "total s", "updates s", "snapshot us");
+
+    mt19937 rng(17);
+    prqueue<int> pq;
+    persistent_prqueue<int> pv;
+    for (int i = 0; i < n; i++) {
+        int priority = (int) (rng() % 1000000);
+        pq.enqueue(i, priority);
+        pv = pv.enqueue(i, priority);
+    }
+
+    double snapSecs = 0;
+    long sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int s = 0; s < snapshots; s++) {
+        for (int i = 0; i < opsPer; i++) {
+            pq.enqueue(i, (int) (rng() % 1000000));
+            sum += pq.dequeue();
+        }
+        auto t = chrono::steady_clock::now();
+        prqueue<int> snap = pq;
+        snapSecs += secondsSince(t);
+        sum += snap.size();
+    }
+    double total = secondsSince(start);
+    printf("  %-20s %10.4f %12.4f %14.2f\n", "prqueue", total, total - snapSecs,
+           snapSecs / snapshots * 1e6);
+
+    snapSecs = 0;
+    start = chrono::steady_clock::now();
+    for (int s = 0; s < snapshots; s++) {
+        for (int i = 0; i < opsPer; i++) {
+            pv = pv.enqueue(i, (int) (rng() % 1000000));
+            sum += pv.peek();
+            pv = pv.dequeue();
+        }
+        auto t = chrono::steady_clock::now();
+        persistent_prqueue<int> snap = pv;
+        snapSecs += secondsSince(t);
+        sum += snap.size();
+    }
+    total = secondsSince(start);
+    printf("  %-20s %10.4f %12.4f %14.2f\n", "persistent_prqueue", total, total - snapSecs,
+           snapSecs / snapshots * 1e6);
+    if (sum == 0) {
+        printf("  (checksum 0)\n");
+    }
+}
+
+
+//
+// prefetch:
+//
+// Builds a 2M-element prqueue from random priorities with a loop of
+// enqueue and with enqueue_bulk, then walks it with begin/next and with
+// iterators.  Build with -DPRQUEUE_NO_PREFETCH to compare against the
+// descent and traversal without software prefetching.
+//
+static void benchPrefetch() {
+    const int n = 2000000;
+    vector<pair<int, int>> items;
+    mt19937 rng(29);
+    for (int i = 0; i < n; i++) {
+        items.push_back({i, (int) (rng() % 1000000000)});
+    }
+    printf("prefetch: %d elements, random priorities\n", n);
+
+    prqueue<int> loop;
+    auto start = chrono::steady_clock::now();
+    for (auto& [value, priority] : items) {
+        loop.enqueue(value, priority);
+    }
+    printf("  %-24s %10.4f s\n", "enqueue loop", secondsSince(start));
+
+    prqueue<int> bulk;
+    start = chrono::steady_clock::now();
+    bulk.enqueue_bulk(items.begin(), items.end());
+    printf("  %-24s %10.4f s\n", "enqueue_bulk", secondsSince(start));
+
+    long sum = 0;
+    int value;
+    int priority;
+    start = chrono::steady_clock::now();
+    bulk.begin();
+    while (bulk.next(value, priority)) {
+        sum += value;
+    }
+    printf("  %-24s %10.4f s\n", "begin/next walk", secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    for (auto it = bulk.kth(0); it != prqueue<int>::iterator(); ++it) {
+        sum -= *it;
+    }
+    printf("  %-24s %10.4f s\n", "iterator walk", secondsSince(start));
+    if (sum != 0 || !(loop == bulk)) {
+        printf("  ERROR: the two builds differ\n");
+    }
+}
+
+
+//
+// rcu:
+//
+// One writer runs enqueue/dequeue pairs on a 100K-element queue while
+// monitor threads traverse it continuously: a mutex-guarded prqueue, whose
+// monitors hold the lock for a whole for_each, against rcu_prqueue, whose
+// monitors traverse a version in a read section.
+//
+template<typename Queue, typename Traverse, typename Write>
+static void rcuWorkload(const char* name, Queue& q, int readers, Traverse traverse, Write write) {
+    const int writes = 100000;
+    atomic<bool> done(false);
+    atomic<long> traversals(0);
+    atomic<long> checksum(0);
+    vector<thread> monitors;
+    for (int r = 0; r < readers; r++) {
+        monitors.emplace_back([&]() {
+            while (!done) {
+                checksum.fetch_add(traverse(q), memory_order_relaxed);
+                traversals.fetch_add(1, memory_order_relaxed);
+            }
+        });
+    }
+    mt19937 rng(23);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < writes; i++) {
+        write(q, i, (int) (rng() % 1000000));
+    }
+    double secs = secondsSince(start);
+    done = true;
+    for (auto& m : monitors) {
+        m.join();
+    }
+    printf("  %-20s %8d %14.0f %12ld\n", name, readers, writes / secs, traversals.load());
+    if (readers > 0 && checksum == 0) {
+        printf("  (checksum 0)\n");
+    }
+}
+
+static void benchRcu() {
+    const int n = 100000;
+    printf("rcu: %d elements, 100000 writer op pairs\n", n);
+    printf("  %-20s %8s %14s %12s\n", "queue", "readers", "writer pairs/s", "traversals");
+    struct LOCKED {
+        mutex lock;
+        prqueue<int> pq;
+    };
+    for (int readers : {0, 1, 2}) {
+        LOCKED locked;
+        rcu_prqueue<int> rcu;
+        mt19937 rng(5);
+        for (int i = 0; i < n; i++) {
+            int priority = (int) (rng() % 1000000);
+            locked.pq.enqueue(i, priority);
+            rcu.enqueue(i, priority);
+        }
+        rcuWorkload("mutex + prqueue", locked, readers,
+            [](LOCKED& q) {
+                long sum = 0;
+                lock_guard<mutex> guard(q.lock);
+                q.pq.for_each(execution::seq, [&sum](int value, int) { sum += value; });
+                return sum;
+            },
+            [](LOCKED& q, int value, int priority) {
+                lock_guard<mutex> guard(q.lock);
+                q.pq.enqueue(value, priority);
+                q.pq.dequeue();
+            });
+        rcuWorkload("rcu_prqueue", rcu, readers,
+            [](rcu_prqueue<int>& q) {
+                long sum = 0;
+                auto view = q.read();
+                view->for_each([&sum](int value, int) { sum += value; });
+                return sum;
+            },
+            [](rcu_prqueue<int>& q, int value, int priority) {
+                q.enqueue(value, priority);
+                q.dequeue();
+            });
+    }
+}
+
+
+struct BENCH {
+    const char* name;
+    void (*run)();
+};
+
+static const BENCH benches[] = {
+    {"aging", benchAging},
+    {"async", benchAsync},
+    {"dijkstra", benchDijkstra},
+    {"forkjoin", benchForkjoin},
+    {"frozen", benchFrozen},
+    {"hugepages", benchHugepages},
+    {"mixed", benchMixed},
+    {"numa", benchNuma},
+    {"parallel", benchParallel},
+    {"prefetch", benchPrefetch},
+    {"rcu", benchRcu},
+    {"snapshot", benchSnapshot},
+    {"splay", benchSplay},
+    {"tasks", benchTasks},
+};
+
+int main(int argc, char* argv[]) {
+    for (const BENCH& b : benches) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; i++) {
+            selected = selected || strcmp(argv[i], b.name) == 0;
+        }
+        if (selected) {
+            b.run();
+        }
+    }
+    return 0;
+}
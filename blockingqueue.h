@@ -0,0 +1,183 @@
+/// @file blockingqueue.h
+///
+/// Blocking and timed dequeue on top of prqueue for producer/consumer use.
+
+// Description: blocking_prqueue guards a prqueue with a mutex and lets
+// consumers sleep on a condition variable (a futex on Linux) instead of
+// spinning on size().  Dequeue operations report emptiness through their
+// return value, so a default-constructed T is never mistaken for an
+// element.  Wakeups are batched: a producer only signals when there are
+// more sleeping consumers than signals already in flight, so a burst of
+// enqueues wakes each sleeper once instead of issuing one notify per item.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "prqueue.h"
+
+using namespace std;
+
+template<typename T>
+class blocking_prqueue {
+private:
+    mutable mutex lock;     // guards every member below
+    condition_variable cv;  // consumers wait here for elements
+    prqueue<T> pq;
+    int waiters;            // consumers blocked on cv
+    int signaled;           // notifies issued but not yet observed by a waiter
+
+    // Returns how many sleeping consumers to wake for n new elements and
+    // records them as signaled.  Caller holds lock.
+    int _claimWakeups(int n) {
+        int idle = waiters - signaled;
+        int wake = n < idle ? n : idle;
+        if (wake < 0) {
+            wake = 0;
+        }
+        signaled += wake;
+        return wake;
+    }
+
+    // Bookkeeping after a waiter returns from cv, for whatever reason.
+    // Caller holds lock.
+    void _observeWakeup() {
+        if (signaled > 0) {
+            signaled--;
+        }
+    }
+
+    // Issues the wakeups claimed by _claimWakeups after lock is released.
+    void _notify(int wake) {
+        if (wake == 1) {
+            cv.notify_one();
+        } else if (wake > 1) {
+            cv.notify_all();
+        }
+    }
+
+public:
+    blocking_prqueue() {
+        waiters = 0;
+        signaled = 0;
+    }
+
+    blocking_prqueue(const blocking_prqueue&) = delete;
+    blocking_prqueue& operator=(const blocking_prqueue&) = delete;
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value and wakes a sleeping consumer if none has been
+    // signaled yet.
+    // O(logn + m)
+    //
+    void enqueue(T value, int priority) {
+        int wake;
+        {
+            lock_guard<mutex> guard(lock);
+            pq.enqueue(move(value), priority);
+            wake = _claimWakeups(1);
+        }
+        _notify(wake);
+    }
+
+
+    //
+    // enqueue_bulk:
+    //
+    // Inserts every (value, priority) pair of [first, last) under a single
+    // lock acquisition with prqueue::enqueue_bulk, then wakes at most one
+    // consumer per new element.
+    // O(k(logn + m)) for k elements
+    //
+    template<typename InputIt>
+    void enqueue_bulk(InputIt first, InputIt last) {
+        int wake;
+        {
+            lock_guard<mutex> guard(lock);
+            int before = pq.size();
+            pq.enqueue_bulk(first, last);
+            wake = _claimWakeups(pq.size() - before);
+        }
+        _notify(wake);
+    }
+
+
+    //
+    // try_dequeue:
+    //
+    // Removes the next element into value and returns true, or returns
+    // false immediately if the queue is empty.
+    // O(logn + m)
+    //
+    bool try_dequeue(T& value) {
+        lock_guard<mutex> guard(lock);
+        optional<T> next = pq.try_dequeue();
+        if (!next) {
+            return false;
+        }
+        value = move(*next);
+        return true;
+    }
+
+
+    //
+    // wait_dequeue:
+    //
+    // Removes and returns the next element, sleeping until one is
+    // available.
+    // O(logn + m) once an element is available
+    //
+    T wait_dequeue() {
+        unique_lock<mutex> guard(lock);
+        while (pq.size() == 0) {
+            waiters++;
+            cv.wait(guard);
+            waiters--;
+            _observeWakeup();
+        }
+        return pq.dequeue();
+    }
+
+
+    //
+    // wait_dequeue_for:
+    //
+    // Like wait_dequeue, but gives up after timeout.  Returns true and
+    // stores the element in value on success, false on timeout.
+    //
+    template<typename Rep, typename Period>
+    bool wait_dequeue_for(T& value, const chrono::duration<Rep, Period>& timeout) {
+        auto deadline = chrono::steady_clock::now() + timeout;
+        unique_lock<mutex> guard(lock);
+        while (pq.size() == 0) {
+            waiters++;
+            cv_status status = cv.wait_until(guard, deadline);
+            waiters--;
+            _observeWakeup();
+            if (status == cv_status::timeout && pq.size() == 0) {
+                return false;
+            }
+        }
+        value = pq.dequeue();
+        return true;
+    }
+
+
+    //
+    // size:
+    //
+    // Returns the # of queued elements at the time of the call.
+    // O(1)
+    //
+    int size() {
+        lock_guard<mutex> guard(lock);
+        return pq.size();
+    }
+};
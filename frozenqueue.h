@@ -0,0 +1,279 @@
+/// @file frozenqueue.h
+///
+/// Immutable, contiguous snapshot of a prqueue (see prqueue::freeze) laid
+/// out for cache-efficient searching and scanning.
+
+// Description: frozen_prqueue stores the elements in one array in priority
+// order, duplicates adjacent in FIFO order, so an in-order scan is a
+// sequential walk.  Searches go through a separate index holding just the
+// distinct priorities as a complete binary search tree in van Emde Boas
+// order: the top half of the tree (by height) is laid out first, then each
+// bottom subtree, recursively, so every root-to-leaf search touches
+// O(log_B n) cache lines for any line size B instead of the O(logn)
+// scattered nodes of the pointer tree.  The layout is implicit: children
+// are located with per-depth tables rather than stored links, so the index
+// costs 4 bytes per distinct priority.  Nothing can be
+// modified after construction, so any number of threads may read a
+// frozen_prqueue concurrently.
+
+#pragma once
+
+#include <climits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+template<typename T>
+class frozen_prqueue {
+private:
+    static const int MAX_HEIGHT = 32;
+
+    vector<T> vals;         // every element, in priority then FIFO order
+    vector<int> prios;      // priority of vals[i]
+    vector<int> starts;     // index in vals of the first element of each distinct priority
+    vector<int> keys;       // the distinct priorities as a complete search tree of
+                            // height "height" in van Emde Boas order, padded with INT_MAX
+    int height;
+
+    // Navigation tables (Brodal, Fagerberg and Jacob): a node at depth d is
+    // the root of a bottom tree of size bottomSize[d] hanging below a top
+    // tree of size topSize[d] whose root is at depth topDepth[d].
+    int topDepth[MAX_HEIGHT];
+    int topSize[MAX_HEIGHT];
+    int bottomSize[MAX_HEIGHT];
+
+    // Fills the tables for the subtree of height h whose root is at depth
+    // d.  The top tree takes floor(h / 2) levels.
+    void _tables(int d, int h) {
+        if (h <= 1) {
+            return;
+        }
+        int top = h / 2;
+        topDepth[d + top] = d;
+        topSize[d + top] = (1 << top) - 1;
+        bottomSize[d + top] = (1 << (h - top)) - 1;
+        _tables(d, top);
+        _tables(d + top, h - top);
+    }
+
+    // Position in keys of the node with BFS number i (root 1) at depth d,
+    // given the positions of its ancestors in pos[0..d).
+    int _position(unsigned i, int d, const int* pos) const {
+        if (d == 0) {
+            return 0;
+        }
+        int up = topDepth[d];
+        return pos[up] + topSize[d] + (int) (i & ((1u << (d - up)) - 1)) * bottomSize[d];
+    }
+
+    // In-order rank of the node with BFS number i at depth d.
+    int _rank(unsigned i, int d) const {
+        return (int) ((((i - (1u << d)) << 1) + 1) << (height - 1 - d)) - 1;
+    }
+
+    // Stores every key of the subtree rooted at BFS number i in keys.
+    void _place(unsigned i, int d, int* pos) {
+        if (d >= height) {
+            return;
+        }
+        pos[d] = _position(i, d, pos);
+        int r = _rank(i, d);
+        keys[pos[d]] = r < (int) starts.size() ? prios[starts[r]] : INT_MAX;
+        _place(2 * i, d + 1, pos);
+        _place(2 * i + 1, d + 1, pos);
+    }
+
+    // Index into vals of the first element with priority >= bound (> bound
+    // when strict), or size() if there is none.
+    int _firstAtLeast(int bound, bool strict) const {
+        int pos[MAX_HEIGHT];
+        unsigned i = 1;
+        unsigned best = 0;
+        int bestDepth = 0;
+        for (int d = 0; d < height; d++) {
+            // Written without branches so that the compiler uses
+            // conditional moves: the direction is unpredictable.
+            pos[d] = _position(i, d, pos);
+            int key = keys[pos[d]];
+            bool goLeft = key > bound || (!strict && key == bound);
+            best = goLeft ? i : best;
+            bestDepth = goLeft ? d : bestDepth;
+            i = 2 * i + (goLeft ? 0 : 1);
+        }
+        if (best == 0) {
+            return (int) vals.size();
+        }
+        int r = _rank(best, bestDepth);
+        return r < (int) starts.size() ? starts[r] : (int) vals.size();
+    }
+
+public:
+    //
+    // iterator:
+    //
+    // Random-access position in the element array; dereferences to the
+    // value, priority() gives its priority.
+    //
+    class iterator {
+    private:
+        const frozen_prqueue* q;
+        int i;
+
+    public:
+        iterator(const frozen_prqueue* queue = nullptr, int index = 0) : q(queue), i(index) {}
+
+        const T& operator*() const {
+            return q->vals[i];
+        }
+
+        const T* operator->() const {
+            return &q->vals[i];
+        }
+
+        int priority() const {
+            return q->prios[i];
+        }
+
+        iterator& operator++() {
+            i++;
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            i++;
+            return old;
+        }
+
+        int operator-(const iterator& other) const {
+            return i - other.i;
+        }
+
+        bool operator==(const iterator& other) const {
+            return i == other.i;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return i != other.i;
+        }
+    };
+
+    struct range_view {
+        iterator first;
+        iterator last;
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+    };
+
+
+    //
+    // constructor:
+    //
+    // Builds the snapshot from (value, priority) pairs already in priority
+    // and FIFO order, as prqueue::freeze supplies them.
+    // O(n)
+    //
+    explicit frozen_prqueue(vector<pair<T, int>>&& items = {}) {
+        vals.reserve(items.size());
+        prios.reserve(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            if (i == 0 || items[i].second != items[i - 1].second) {
+                starts.push_back((int) i);
+            }
+            vals.push_back(move(items[i].first));
+            prios.push_back(items[i].second);
+        }
+
+        height = 0;
+        while ((1u << height) - 1 < starts.size()) {
+            height++;
+        }
+        keys.resize((1u << height) - 1);
+        _tables(0, height);
+        int pos[MAX_HEIGHT];
+        _place(1, 0, pos);
+    }
+
+
+    //
+    // size / begin / end:
+    //
+    // O(1)
+    //
+    int size() const {
+        return (int) vals.size();
+    }
+
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, (int) vals.size());
+    }
+
+
+    //
+    // lower_bound / upper_bound:
+    //
+    // First element whose priority is >= priority (lower_bound) or >
+    // priority (upper_bound), or end().
+    // O(logn), touching O(log_B n) cache lines
+    //
+    iterator lower_bound(int priority) const {
+        return iterator(this, _firstAtLeast(priority, false));
+    }
+
+    iterator upper_bound(int priority) const {
+        return iterator(this, _firstAtLeast(priority, true));
+    }
+
+
+    //
+    // find:
+    //
+    // The elements with exactly this priority, in FIFO order; empty if
+    // there are none.
+    // O(logn)
+    //
+    range_view find(int priority) const {
+        return range_view{lower_bound(priority), upper_bound(priority)};
+    }
+
+
+    //
+    // range / count_range:
+    //
+    // The elements whose priority lies in [lo, hi), and their number.
+    // O(logn)
+    //
+    range_view range(int lo, int hi) const {
+        if (hi <= lo) {
+            return range_view{end(), end()};
+        }
+        return range_view{lower_bound(lo), lower_bound(hi)};
+    }
+
+    int count_range(int lo, int hi) const {
+        range_view r = range(lo, hi);
+        return r.last - r.first;
+    }
+
+
+    //
+    // kth:
+    //
+    // The element dequeue would return after k others, or end().
+    // O(1)
+    //
+    iterator kth(int k) const {
+        return (k < 0 || k >= size()) ? end() : iterator(this, k);
+    }
+};
@@ -0,0 +1,175 @@
+/// @file inlinetask.h
+///
+/// Move-only type-erased callable with inline storage, for task queues.
+
+// Description: inline_task holds any callable taking no arguments.  Callables
+// of up to INLINE_SIZE bytes that can be moved without throwing are stored
+// inside the inline_task itself; only larger ones go to the heap.  Queued
+// as prqueue<inline_task> (see task_queue) the closure lives in the queue
+// node, so an item costs the one node allocation instead of the node plus
+// the heap block std::function needs for any capture over 16 bytes.
+// Unlike std::function it is move-only, so closures may own move-only
+// state such as a unique_ptr.
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "prqueue.h"
+
+using namespace std;
+
+class inline_task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    // True when a callable of type F is stored inline rather than on the heap.
+    template<typename F>
+    static constexpr bool fits_inline = sizeof(F) <= INLINE_SIZE &&
+                                        alignof(F) <= alignof(max_align_t) &&
+                                        is_nothrow_move_constructible_v<F>;
+
+private:
+    // Per-type operations; one static table per stored callable type.
+    struct OPS {
+        void (*invoke)(void* storage);
+        void (*relocate)(void* from, void* to);  // move into "to", destroy "from";
+                                                 // nullptr when a memcpy will do
+        void (*destroy)(void* storage);
+    };
+
+    // Callable constructed in place inside storage.
+    template<typename F>
+    struct INLINE_OPS {
+        static void invoke(void* storage) {
+            (*static_cast<F*>(storage))();
+        }
+
+        static void relocate(void* from, void* to) {
+            F* f = static_cast<F*>(from);
+            new (to) F(move(*f));
+            f->~F();
+        }
+
+        static void destroy(void* storage) {
+            static_cast<F*>(storage)->~F();
+        }
+
+        static constexpr OPS table = {invoke, is_trivially_copyable_v<F> ? nullptr : relocate,
+                                      destroy};
+    };
+
+    // Callable on the heap; storage holds the pointer.
+    template<typename F>
+    struct HEAP_OPS {
+        static void invoke(void* storage) {
+            (**static_cast<F**>(storage))();
+        }
+
+        static void destroy(void* storage) {
+            delete *static_cast<F**>(storage);
+        }
+
+        static constexpr OPS table = {invoke, nullptr, destroy};
+    };
+
+    alignas(max_align_t) unsigned char storage[INLINE_SIZE];
+    const OPS* ops;  // nullptr when empty
+
+    // Takes over the callable of other, leaving other empty.
+    void _take(inline_task& other) noexcept {
+        ops = other.ops;
+        if (ops == nullptr) {
+            return;
+        }
+        if (ops->relocate != nullptr) {
+            ops->relocate(other.storage, storage);
+        } else {
+            memcpy(storage, other.storage, INLINE_SIZE);
+        }
+        other.ops = nullptr;
+    }
+
+public:
+    //
+    // constructors:
+    //
+    // An empty task, or a task wrapping f.
+    // O(1), plus one allocation when f does not fit inline
+    //
+    inline_task() noexcept : ops(nullptr) {}
+
+    inline_task(nullptr_t) noexcept : ops(nullptr) {}
+
+    template<typename F>
+        requires (!is_same_v<remove_cvref_t<F>, inline_task> && is_invocable_v<decay_t<F>&>)
+    inline_task(F&& f) {
+        typedef decay_t<F> FN;
+        if constexpr (fits_inline<FN>) {
+            new (storage) FN(forward<F>(f));
+            ops = &INLINE_OPS<FN>::table;
+        } else {
+            *reinterpret_cast<FN**>(storage) = new FN(forward<F>(f));
+            ops = &HEAP_OPS<FN>::table;
+        }
+    }
+
+    inline_task(inline_task&& other) noexcept {
+        _take(other);
+    }
+
+    inline_task& operator=(inline_task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            _take(other);
+        }
+        return *this;
+    }
+
+    inline_task(const inline_task&) = delete;
+    inline_task& operator=(const inline_task&) = delete;
+
+    ~inline_task() {
+        reset();
+    }
+
+
+    //
+    // reset:
+    //
+    // Destroys the callable, leaving the task empty.
+    // O(1)
+    //
+    void reset() noexcept {
+        if (ops != nullptr) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+
+    //
+    // operator():
+    //
+    // Calls the callable.  The task must not be empty.
+    //
+    void operator()() {
+        ops->invoke(storage);
+    }
+
+    explicit operator bool() const {
+        return ops != nullptr;
+    }
+};
+
+
+//
+// task_queue:
+//
+// Priority queue of type-erased tasks with one allocation per queued task.
+//
+typedef prqueue<inline_task> task_queue;
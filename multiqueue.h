@@ -0,0 +1,255 @@
+/// @file multiqueue.h
+///
+/// Relaxed concurrent priority queue built on top of prqueue.
+
+// Description: multiqueue spreads its elements over c*P independent prqueue
+// shards, each protected by its own mutex that is only ever try-locked.
+// enqueue inserts into a random shard; dequeue samples two random shards and
+// pops from the one whose minimum is better.  The element returned is not
+// always the global minimum, but contention on a single minimum disappears
+// and throughput scales with the number of threads.  The amount of
+// relaxation can be measured with the rank-error statistics.
+
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "prqueue.h"
+
+using namespace std;
+
+template<typename T>
+class multiqueue {
+private:
+    struct alignas(64) SHARD {
+        mutex lock;       // only ever try-locked
+        prqueue<T> pq;    // elements owned by this shard
+        atomic<int> top;  // cached minimum priority, INT_MAX when empty
+
+        SHARD() : top(INT_MAX) {}
+    };
+
+    unique_ptr<SHARD[]> shards;
+    size_t nshards;
+    atomic<long> sz;            // # of elements over all shards
+
+    bool trackRank;             // sample rank error on every dequeue
+    atomic<uint64_t> rankSamples;
+    atomic<uint64_t> rankTotal;
+    atomic<uint64_t> rankMax;
+
+    // Per-thread random generator used to pick shards.
+    static minstd_rand& _rng() {
+        thread_local minstd_rand gen(
+            (unsigned) hash<thread::id>{}(this_thread::get_id()));
+        return gen;
+    }
+
+    size_t _pick() {
+        return _rng()() % nshards;
+    }
+
+    // Refreshes the cached minimum of a shard; caller holds the shard lock.
+    static void _refreshTop(SHARD& s) {
+        int p;
+        s.top.store(s.pq.peek_priority(p) ? p : INT_MAX, memory_order_relaxed);
+    }
+
+    // Counts the shards whose cached minimum is strictly better than the
+    // priority just dequeued.  Each such shard holds at least one element
+    // that should have come out first, so this is a lower bound on the
+    // rank error of the dequeue.
+    void _recordRank(int priority) {
+        uint64_t err = 0;
+        for (size_t i = 0; i < nshards; i++) {
+            if (shards[i].top.load(memory_order_relaxed) < priority) {
+                err++;
+            }
+        }
+        rankSamples.fetch_add(1, memory_order_relaxed);
+        rankTotal.fetch_add(err, memory_order_relaxed);
+        uint64_t prev = rankMax.load(memory_order_relaxed);
+        while (err > prev && !rankMax.compare_exchange_weak(prev, err)) {
+        }
+    }
+
+    // Pops the minimum of shard s if its lock can be taken and it is
+    // non-empty.
+    bool _tryPop(SHARD& s, T& value, int& priority) {
+        if (!s.lock.try_lock()) {
+            return false;
+        }
+        if (!s.pq.peek_priority(priority)) {
+            s.lock.unlock();
+            return false;
+        }
+        value = s.pq.dequeue();
+        _refreshTop(s);
+        s.lock.unlock();
+        sz.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+
+public:
+    //
+    // rank_stats:
+    //
+    // Summary of the rank error observed by dequeue when rank tracking is
+    // enabled.  The error of a single dequeue is the number of shards whose
+    // minimum was better than the element returned.
+    //
+    struct rank_stats {
+        uint64_t samples;  // # of dequeues measured
+        uint64_t total;    // sum of the rank errors
+        uint64_t max;      // largest rank error seen
+
+        double mean() const {
+            return samples == 0 ? 0.0 : (double) total / (double) samples;
+        }
+    };
+
+    //
+    // constructor:
+    //
+    // Creates an empty multiqueue with c * threads shards.  c = 2 is the
+    // usual choice; larger values reduce contention at the price of larger
+    // rank errors.
+    // O(c * threads)
+    //
+    explicit multiqueue(size_t threads = thread::hardware_concurrency(),
+                        size_t c = 2) {
+        nshards = (threads == 0 ? 1 : threads) * (c == 0 ? 1 : c);
+        if (nshards < 2) {
+            nshards = 2;
+        }
+        shards.reset(new SHARD[nshards]);
+        sz = 0;
+        trackRank = false;
+        rankSamples = 0;
+        rankTotal = 0;
+        rankMax = 0;
+    }
+
+    multiqueue(const multiqueue&) = delete;
+    multiqueue& operator=(const multiqueue&) = delete;
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value into a randomly chosen shard whose lock is free.
+    // O(logn + m) for the chosen shard
+    //
+    void enqueue(T value, int priority) {
+        for (;;) {
+            SHARD& s = shards[_pick()];
+            if (!s.lock.try_lock()) {
+                continue;
+            }
+            s.pq.enqueue(move(value), priority);
+            if (priority < s.top.load(memory_order_relaxed)) {
+                s.top.store(priority, memory_order_relaxed);
+            }
+            s.lock.unlock();
+            sz.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+    }
+
+
+    //
+    // dequeue:
+    //
+    // Samples two random shards and removes the minimum of the better one,
+    // storing it in value/priority.  Returns false only if every shard was
+    // found empty.
+    // O(logn + m) for the chosen shard
+    //
+    bool dequeue(T& value, int& priority) {
+        for (size_t attempt = 0; attempt < 2 * nshards; attempt++) {
+            size_t i = _pick();
+            size_t j = _pick();
+            int pi = shards[i].top.load(memory_order_relaxed);
+            int pj = shards[j].top.load(memory_order_relaxed);
+            if (pi == INT_MAX && pj == INT_MAX) {
+                if (sz.load(memory_order_relaxed) <= 0) {
+                    return false;
+                }
+                continue;
+            }
+            SHARD& s = shards[pj < pi ? j : i];
+            if (_tryPop(s, value, priority)) {
+                if (trackRank) {
+                    _recordRank(priority);
+                }
+                return true;
+            }
+        }
+
+        // Sampling kept missing; fall back to a sweep so that a non-empty
+        // queue never reports empty.
+        for (size_t i = 0; i < nshards; i++) {
+            SHARD& s = shards[i];
+            lock_guard<mutex> guard(s.lock);
+            if (s.pq.peek_priority(priority)) {
+                value = s.pq.dequeue();
+                _refreshTop(s);
+                sz.fetch_sub(1, memory_order_relaxed);
+                if (trackRank) {
+                    _recordRank(priority);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    //
+    // size:
+    //
+    // Returns the # of elements over all shards.  The value is exact only
+    // when no other thread is modifying the queue.
+    // O(1)
+    //
+    long size() const {
+        return sz.load(memory_order_relaxed);
+    }
+
+    //
+    // shard_count:
+    //
+    // Returns the # of internal prqueue shards.
+    // O(1)
+    //
+    size_t shard_count() const {
+        return nshards;
+    }
+
+
+    //
+    // track_rank_error / rank_error / reset_rank_error:
+    //
+    // Rank tracking scans every shard's cached minimum after each dequeue,
+    // so it is off by default and meant for measurement runs.
+    //
+    void track_rank_error(bool enabled) {
+        trackRank = enabled;
+    }
+
+    rank_stats rank_error() const {
+        return rank_stats{rankSamples.load(), rankTotal.load(), rankMax.load()};
+    }
+
+    void reset_rank_error() {
+        rankSamples = 0;
+        rankTotal = 0;
+        rankMax = 0;
+    }
+};
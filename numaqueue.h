@@ -0,0 +1,183 @@
+/// @file numaqueue.h
+///
+/// Per-socket priority queues with socket-local node memory and
+/// cross-socket stealing.
+
+// Description: numa_prqueue keeps one prqueue per NUMA node (socket), each
+// drawing its nodes from a node_arena bound to that socket.  Producers
+// enqueue into the queue of the socket they run on and consumers dequeue
+// from it, so in the common case a node is allocated, linked, read and
+// freed by one socket and its cache lines never cross the interconnect.
+// Only when the local queue is empty does a consumer steal, one element at
+// a time, from the remote queue with the best minimum.  Elements stay in
+// the queue (and arena) of the socket that produced them, so the order is
+// strict per socket but relaxed globally: a consumer drains its own socket
+// before it looks at better elements elsewhere.
+
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "arena.h"
+#include "prqueue.h"
+
+using namespace std;
+
+template<typename T>
+class numa_prqueue {
+private:
+    struct alignas(64) SOCKET {
+        mutex lock;        // guards pq
+        node_arena arena;  // memory of pq's nodes; declared first so it outlives pq
+        prqueue<T> pq;
+        atomic<int> top;   // cached minimum priority, INT_MAX when empty
+
+        SOCKET(int node, bool hugePages)
+            : arena(prqueue<T>::NODE_SIZE, node, hugePages), top(INT_MAX) {
+            pq.set_arena(&arena);
+        }
+    };
+
+    vector<unique_ptr<SOCKET>> sockets;
+    atomic<long> sz;
+    atomic<long> nsteals;
+
+    // Refreshes the cached minimum of s; caller holds its lock.
+    static void _refreshTop(SOCKET& s) {
+        int p;
+        s.top.store(s.pq.peek_priority(p) ? p : INT_MAX, memory_order_relaxed);
+    }
+
+    // Pops the minimum of s if it has one.
+    bool _pop(SOCKET& s, T& value, int& priority) {
+        lock_guard<mutex> guard(s.lock);
+        if (!s.pq.peek_priority(priority)) {
+            return false;
+        }
+        value = s.pq.dequeue();
+        _refreshTop(s);
+        sz.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+
+public:
+    //
+    // constructor:
+    //
+    // One queue per NUMA node, or per socket of a given count; sockets
+    // beyond the machine's nodes use first-touch arenas.  hugePages backs
+    // the arenas with huge pages (see node_arena).
+    // O(sockets)
+    //
+    explicit numa_prqueue(int nsockets = 0, bool hugePages = false) {
+        if (nsockets <= 0) {
+            nsockets = node_arena::numa_nodes();
+        }
+        int nodes = node_arena::numa_nodes();
+        for (int i = 0; i < nsockets; i++) {
+            sockets.push_back(make_unique<SOCKET>(i < nodes ? i : -1, hugePages));
+        }
+        sz = 0;
+        nsteals = 0;
+    }
+
+    numa_prqueue(const numa_prqueue&) = delete;
+    numa_prqueue& operator=(const numa_prqueue&) = delete;
+
+
+    //
+    // home:
+    //
+    // The socket queue of the calling thread's NUMA node.
+    // O(1)
+    //
+    int home() const {
+        return node_arena::current_node() % (int) sockets.size();
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value into the queue of socket (default: home()).
+    // O(logn) for that socket's queue
+    //
+    void enqueue(T value, int priority, int socket = -1) {
+        SOCKET& s = *sockets[socket < 0 ? home() : socket];
+        lock_guard<mutex> guard(s.lock);
+        s.pq.enqueue(move(value), priority);
+        if (priority < s.top.load(memory_order_relaxed)) {
+            s.top.store(priority, memory_order_relaxed);
+        }
+        sz.fetch_add(1, memory_order_relaxed);
+    }
+
+
+    //
+    // dequeue:
+    //
+    // Removes the minimum of the queue of socket (default: home()) into
+    // value/priority.  If that queue is empty, steals the minimum of the
+    // remote queue with the best cached minimum instead.  Returns false
+    // only when every queue was found empty.
+    // O(logn) locally, plus O(sockets) to pick a victim when stealing
+    //
+    bool dequeue(T& value, int& priority, int socket = -1) {
+        size_t self = socket < 0 ? home() : socket;
+        if (_pop(*sockets[self], value, priority)) {
+            return true;
+        }
+        for (;;) {
+            size_t victim = self;
+            int best = INT_MAX;
+            for (size_t i = 0; i < sockets.size(); i++) {
+                int p = sockets[i]->top.load(memory_order_relaxed);
+                if (i != self && p < best) {
+                    best = p;
+                    victim = i;
+                }
+            }
+            if (victim == self) {
+                return false;
+            }
+            if (_pop(*sockets[victim], value, priority)) {
+                nsteals.fetch_add(1, memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+
+    //
+    // size / socket_count / steals:
+    //
+    // Elements over all sockets (exact only while no other thread modifies
+    // the queue), # of socket queues, and dequeues served by stealing.
+    // O(1)
+    //
+    long size() const {
+        return sz.load(memory_order_relaxed);
+    }
+
+    int socket_count() const {
+        return (int) sockets.size();
+    }
+
+    long steals() const {
+        return nsteals.load(memory_order_relaxed);
+    }
+
+
+    //
+    // arena:
+    //
+    // The node arena of a socket queue, e.g. to check it is bound.
+    //
+    node_arena& arena(int socket) {
+        return sockets[socket]->arena;
+    }
+};
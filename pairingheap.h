@@ -0,0 +1,495 @@
+/// @file pairingheap.h
+///
+/// Pairing heap and rank-pairing heap backends with O(1) amortized
+/// decrease_key, for graph algorithms.
+
+// Description: both heaps follow the prqueue interface: enqueue returns a
+// handle to the element, decrease_key moves it to a better priority,
+// dequeue removes the best element (FIFO among equal priorities).  Ties are
+// broken by an insertion sequence number, and decrease_key gives the
+// element a new one, so it queues behind the elements already at its new
+// priority exactly as prqueue::decrease_key does.
+//
+// pairing_heap is the classic multiway heap with two-pass merging on
+// dequeue: O(1) enqueue, O(logn) amortized dequeue, and decrease_key in
+// o(logn) amortized (O(1) in practice).
+//
+// rank_pairing_heap is the type-1 rank-pairing heap of Haeupler, Sen and
+// Tarjan: a list of half-ordered half trees with ranks, linked one pass at
+// a time on dequeue.  It matches the Fibonacci heap bounds, O(1) amortized
+// enqueue and decrease_key and O(logn) amortized dequeue, without cascading
+// cuts.
+//
+// A handle stays valid until its element is dequeued; handles are not
+// checked, so passing a handle of a dequeued element is undefined.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+template<typename T>
+class pairing_heap {
+private:
+    struct NODE {
+        int priority;
+        uint64_t seq;    // insertion order, breaks ties between equal priorities
+        T value;
+        NODE* child;     // first child
+        NODE* sibling;   // next sibling
+        NODE* prev;      // parent for a first child, otherwise previous sibling
+    };
+    NODE* root;
+    int sz;
+    uint64_t nextSeq;
+
+    static bool _less(const NODE* a, const NODE* b) {
+        return a->priority < b->priority || (a->priority == b->priority && a->seq < b->seq);
+    }
+
+    // Melds two detached heaps.
+    static NODE* _meld(NODE* a, NODE* b) {
+        if (a == nullptr) {
+            return b;
+        }
+        if (b == nullptr) {
+            return a;
+        }
+        if (_less(b, a)) {
+            std::swap(a, b);
+        }
+        b->prev = a;
+        b->sibling = a->child;
+        if (a->child != nullptr) {
+            a->child->prev = b;
+        }
+        a->child = b;
+        return a;
+    }
+
+    // Two-pass merge of the sibling list starting at first: meld pairs left
+    // to right, then meld the results right to left.
+    static NODE* _mergePairs(NODE* first) {
+        NODE* pairs = nullptr;   // results of the first pass, last one first
+        while (first != nullptr) {
+            NODE* a = first;
+            NODE* b = a->sibling;
+            first = b != nullptr ? b->sibling : nullptr;
+            a->sibling = a->prev = nullptr;
+            if (b != nullptr) {
+                b->sibling = b->prev = nullptr;
+            }
+            NODE* m = _meld(a, b);
+            m->sibling = pairs;
+            pairs = m;
+        }
+        NODE* result = nullptr;
+        while (pairs != nullptr) {
+            NODE* next = pairs->sibling;
+            pairs->sibling = nullptr;
+            result = _meld(pairs, result);
+            pairs = next;
+        }
+        return result;
+    }
+
+public:
+    struct handle {
+        NODE* node = nullptr;
+
+        explicit operator bool() const {
+            return node != nullptr;
+        }
+    };
+
+    pairing_heap() {
+        root = nullptr;
+        sz = 0;
+        nextSeq = 0;
+    }
+
+    pairing_heap(const pairing_heap&) = delete;
+    pairing_heap& operator=(const pairing_heap&) = delete;
+
+    ~pairing_heap() {
+        clear();
+    }
+
+
+    //
+    // clear:
+    //
+    // Removes and frees every element.
+    // O(n)
+    //
+    void clear() {
+        vector<NODE*> pending;
+        if (root != nullptr) {
+            pending.push_back(root);
+        }
+        while (!pending.empty()) {
+            NODE* node = pending.back();
+            pending.pop_back();
+            for (NODE* c = node->child; c != nullptr; c = c->sibling) {
+                pending.push_back(c);
+            }
+            delete node;
+        }
+        root = nullptr;
+        sz = 0;
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value and returns a handle to it.
+    // O(1)
+    //
+    handle enqueue(T value, int priority) {
+        NODE* node = new NODE{priority, nextSeq++, move(value), nullptr, nullptr, nullptr};
+        root = _meld(root, node);
+        sz++;
+        return handle{node};
+    }
+
+
+    //
+    // decrease_key:
+    //
+    // Moves the element of h to priority, behind the elements already
+    // there, and returns the handle to use from now on (h itself).
+    // Nothing happens unless priority is better than the current one.
+    // O(1), with O(logn) amortized charged to the next dequeue
+    //
+    handle decrease_key(handle h, int priority) {
+        NODE* x = h.node;
+        if (priority >= x->priority) {
+            return h;
+        }
+        x->priority = priority;
+        x->seq = nextSeq++;
+        if (x == root) {
+            return h;
+        }
+        if (x->prev->child == x) {
+            x->prev->child = x->sibling;
+        } else {
+            x->prev->sibling = x->sibling;
+        }
+        if (x->sibling != nullptr) {
+            x->sibling->prev = x->prev;
+        }
+        x->sibling = x->prev = nullptr;
+        root = _meld(root, x);
+        return h;
+    }
+
+
+    //
+    // dequeue / try_dequeue:
+    //
+    // Remove the best element.  dequeue returns T{} and try_dequeue an
+    // empty optional when the heap is empty.
+    // O(logn) amortized
+    //
+    T dequeue() {
+        optional<T> value = try_dequeue();
+        return value ? move(*value) : T{};
+    }
+
+    optional<T> try_dequeue() {
+        if (root == nullptr) {
+            return nullopt;
+        }
+        NODE* node = root;
+        optional<T> value(move(node->value));
+        root = _mergePairs(node->child);
+        delete node;
+        sz--;
+        return value;
+    }
+
+
+    //
+    // peek_priority / size:
+    //
+    // O(1)
+    //
+    bool peek_priority(int& priority) const {
+        if (root == nullptr) {
+            return false;
+        }
+        priority = root->priority;
+        return true;
+    }
+
+    int size() const {
+        return sz;
+    }
+};
+
+
+template<typename T>
+class rank_pairing_heap {
+private:
+    struct NODE {
+        int priority;
+        uint64_t seq;    // insertion order, breaks ties between equal priorities
+        T value;
+        NODE* left;      // half-ordered: left subtree keys are no better than this one
+        NODE* right;     // unordered w.r.t. this node; null for roots
+        NODE* parent;    // null for roots
+        int rank;
+    };
+    vector<NODE*> roots;   // roots of the half trees
+    NODE* minNode;         // best root, nullptr when empty
+    int sz;
+    uint64_t nextSeq;
+    vector<NODE*> buckets; // scratch space for dequeue, indexed by rank
+
+    static bool _less(const NODE* a, const NODE* b) {
+        return a->priority < b->priority || (a->priority == b->priority && a->seq < b->seq);
+    }
+
+    static int _rank(const NODE* node) {
+        return node == nullptr ? -1 : node->rank;
+    }
+
+    // Links two half trees of equal rank: the loser becomes the left child
+    // of the winner, whose old left subtree becomes the loser's right one.
+    static NODE* _link(NODE* a, NODE* b) {
+        NODE* winner = _less(b, a) ? b : a;
+        NODE* loser = winner == a ? b : a;
+        loser->right = winner->left;
+        if (loser->right != nullptr) {
+            loser->right->parent = loser;
+        }
+        loser->parent = winner;
+        winner->left = loser;
+        winner->rank++;
+        return winner;
+    }
+
+    // Adds a detached half tree to the root list.
+    void _addRoot(NODE* node) {
+        node->parent = nullptr;
+        node->right = nullptr;
+        node->rank = _rank(node->left) + 1;
+        roots.push_back(node);
+        if (minNode == nullptr || _less(node, minNode)) {
+            minNode = node;
+        }
+    }
+
+public:
+    struct handle {
+        NODE* node = nullptr;
+
+        explicit operator bool() const {
+            return node != nullptr;
+        }
+    };
+
+    rank_pairing_heap() {
+        minNode = nullptr;
+        sz = 0;
+        nextSeq = 0;
+    }
+
+    rank_pairing_heap(const rank_pairing_heap&) = delete;
+    rank_pairing_heap& operator=(const rank_pairing_heap&) = delete;
+
+    ~rank_pairing_heap() {
+        clear();
+    }
+
+
+    //
+    // clear:
+    //
+    // Removes and frees every element.
+    // O(n)
+    //
+    void clear() {
+        vector<NODE*> pending(roots);
+        while (!pending.empty()) {
+            NODE* node = pending.back();
+            pending.pop_back();
+            if (node->left != nullptr) {
+                pending.push_back(node->left);
+            }
+            if (node->right != nullptr) {
+                pending.push_back(node->right);
+            }
+            delete node;
+        }
+        roots.clear();
+        minNode = nullptr;
+        sz = 0;
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value as a new one-node half tree and returns a handle to
+    // it.
+    // O(1)
+    //
+    handle enqueue(T value, int priority) {
+        NODE* node = new NODE{priority, nextSeq++, move(value), nullptr, nullptr, nullptr, 0};
+        _addRoot(node);
+        sz++;
+        return handle{node};
+    }
+
+
+    //
+    // decrease_key:
+    //
+    // Moves the element of h to priority, behind the elements already
+    // there, and returns the handle to use from now on (h itself).
+    // Nothing happens unless priority is better than the current one.  A
+    // non-root element is cut out with its left subtree, and the ranks of
+    // its former ancestors are lowered until one does not change.
+    // O(1) amortized
+    //
+    handle decrease_key(handle h, int priority) {
+        NODE* x = h.node;
+        if (priority >= x->priority) {
+            return h;
+        }
+        x->priority = priority;
+        x->seq = nextSeq++;
+        if (x->parent == nullptr) {
+            if (_less(x, minNode)) {
+                minNode = x;
+            }
+            return h;
+        }
+
+        // x's right subtree takes its place.
+        NODE* y = x->parent;
+        NODE* z = x->right;
+        if (y->left == x) {
+            y->left = z;
+        } else {
+            y->right = z;
+        }
+        if (z != nullptr) {
+            z->parent = y;
+        }
+        _addRoot(x);
+
+        // Restore the type-1 rank rule from y upward.
+        for (NODE* u = y; u != nullptr; u = u->parent) {
+            int k;
+            if (u->parent == nullptr) {
+                k = _rank(u->left) + 1;
+            } else {
+                int a = _rank(u->left);
+                int b = _rank(u->right);
+                k = a != b ? (a > b ? a : b) : a + 1;
+            }
+            if (k >= u->rank) {
+                break;
+            }
+            u->rank = k;
+        }
+        return h;
+    }
+
+
+    //
+    // dequeue / try_dequeue:
+    //
+    // Remove the best element.  The right spine of its left subtree
+    // becomes new half trees, and then every pair of half trees of equal
+    // rank is linked once.  dequeue returns T{} and try_dequeue an empty
+    // optional when the heap is empty.
+    // O(logn) amortized
+    //
+    T dequeue() {
+        optional<T> value = try_dequeue();
+        return value ? move(*value) : T{};
+    }
+
+    optional<T> try_dequeue() {
+        if (minNode == nullptr) {
+            return nullopt;
+        }
+        NODE* out = minNode;
+        optional<T> value(move(out->value));
+
+        vector<NODE*> old;
+        old.swap(roots);
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i] == out) {
+                old[i] = old.back();
+                old.pop_back();
+                break;
+            }
+        }
+        for (NODE* y = out->left; y != nullptr;) {
+            NODE* next = y->right;
+            old.push_back(y);
+            y->parent = nullptr;
+            y->right = nullptr;
+            y->rank = _rank(y->left) + 1;
+            y = next;
+        }
+        delete out;
+        sz--;
+
+        // One-pass linking by rank.
+        minNode = nullptr;
+        for (NODE* node : old) {
+            size_t k = (size_t) node->rank;
+            if (k >= buckets.size()) {
+                buckets.resize(k + 1, nullptr);
+            }
+            if (buckets[k] == nullptr) {
+                buckets[k] = node;
+            } else {
+                NODE* linked = _link(buckets[k], node);
+                buckets[k] = nullptr;
+                roots.push_back(linked);
+            }
+        }
+        for (NODE*& node : buckets) {
+            if (node != nullptr) {
+                roots.push_back(node);
+                node = nullptr;
+            }
+        }
+        for (NODE* node : roots) {
+            if (minNode == nullptr || _less(node, minNode)) {
+                minNode = node;
+            }
+        }
+        return value;
+    }
+
+
+    //
+    // peek_priority / size:
+    //
+    // O(1)
+    //
+    bool peek_priority(int& priority) const {
+        if (minNode == nullptr) {
+            return false;
+        }
+        priority = minNode->priority;
+        return true;
+    }
+
+    int size() const {
+        return sz;
+    }
+};
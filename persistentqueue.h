@@ -0,0 +1,222 @@
+/// @file persistentqueue.h
+///
+/// Immutable, persistent priority queue versions with structural sharing.
+
+// Description: a persistent_prqueue is an immutable value.  enqueue and
+// dequeue leave it untouched and return a new version that shares every
+// node it did not have to change with the old one.  Only the nodes on one
+// search path are copied, so a version costs O(logn) new nodes, and taking
+// a snapshot is copying a shared_ptr: O(1), no matter how large the queue.
+// A reader holding a version can traverse it for as long as it likes
+// while writers keep producing newer versions; nodes are freed by
+// reference counting when the last version using them goes away.
+//
+// The tree is a treap keyed by (priority, insertion sequence), so equal
+// priorities come out in FIFO order and the key order never depends on
+// the value type.  Treap weights are a hash of the sequence number, which
+// keeps the expected depth O(logn) for any insertion order.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+template<typename T>
+class persistent_prqueue {
+private:
+    struct NODE;
+    typedef shared_ptr<const NODE> LINK;
+
+    struct NODE {
+        int priority;
+        uint64_t seq;      // insertion order among equal priorities
+        uint64_t weight;   // treap heap order: a parent outweighs its children
+        T value;
+        LINK left;
+        LINK right;
+    };
+
+    LINK root;
+    int sz;
+    uint64_t nextSeq;
+
+    static bool _less(int p1, uint64_t s1, const NODE* b) {
+        return p1 < b->priority || (p1 == b->priority && s1 < b->seq);
+    }
+
+    // Copy of node with new children.  Path copying copies the values on
+    // the path too, so large values are best held by pointer.
+    static LINK _with(const NODE* node, LINK left, LINK right) {
+        return make_shared<const NODE>(NODE{node->priority, node->seq, node->weight,
+                                            node->value, move(left), move(right)});
+    }
+
+    // Splits the tree into keys before (priority, seq) and keys after it.
+    static pair<LINK, LINK> _split(const LINK& node, int priority, uint64_t seq) {
+        if (node == nullptr) {
+            return {nullptr, nullptr};
+        }
+        if (_less(priority, seq, node.get())) {
+            auto [l, r] = _split(node->left, priority, seq);
+            return {l, _with(node.get(), r, node->right)};
+        }
+        auto [l, r] = _split(node->right, priority, seq);
+        return {_with(node.get(), node->left, l), r};
+    }
+
+    // Returns the tree with fresh (a detached node) inserted; fresh.value is
+    // moved into the new node.
+    static LINK _insert(const LINK& node, NODE& fresh) {
+        if (node == nullptr || fresh.weight > node->weight) {
+            auto [l, r] = _split(node, fresh.priority, fresh.seq);
+            return make_shared<const NODE>(NODE{fresh.priority, fresh.seq, fresh.weight,
+                                                move(fresh.value), l, r});
+        }
+        if (_less(fresh.priority, fresh.seq, node.get())) {
+            return _with(node.get(), _insert(node->left, fresh), node->right);
+        }
+        return _with(node.get(), node->left, _insert(node->right, fresh));
+    }
+
+    // Returns the tree without its leftmost node.
+    static LINK _removeMin(const LINK& node) {
+        if (node->left == nullptr) {
+            return node->right;
+        }
+        return _with(node.get(), _removeMin(node->left), node->right);
+    }
+
+    static const NODE* _first(const NODE* node) {
+        while (node != nullptr && node->left != nullptr) {
+            node = node->left.get();
+        }
+        return node;
+    }
+
+    static uint64_t _weight(uint64_t seq) {
+        uint64_t h = seq + 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    persistent_prqueue(LINK r, int size, uint64_t seq) : root(move(r)), sz(size), nextSeq(seq) {}
+
+public:
+    //
+    // constructor:
+    //
+    // The empty queue.
+    // O(1)
+    //
+    persistent_prqueue() : root(nullptr), sz(0), nextSeq(0) {}
+
+
+    //
+    // enqueue:
+    //
+    // Returns a new version that also holds value, behind any elements of
+    // the same priority.  This version is unchanged.
+    // O(logn) expected time and new nodes
+    //
+    persistent_prqueue enqueue(T value, int priority) const {
+        NODE fresh{priority, nextSeq, _weight(nextSeq), move(value), nullptr, nullptr};
+        return persistent_prqueue(_insert(root, fresh), sz + 1, nextSeq + 1);
+    }
+
+
+    //
+    // dequeue:
+    //
+    // Returns a new version without the next element (see peek).  An empty
+    // queue returns itself.  This version is unchanged.
+    // O(logn) expected time and new nodes
+    //
+    persistent_prqueue dequeue() const {
+        if (root == nullptr) {
+            return *this;
+        }
+        return persistent_prqueue(_removeMin(root), sz - 1, nextSeq);
+    }
+
+
+    //
+    // peek / peek_ref / peek_priority:
+    //
+    // The next element: T{}, nullptr or false respectively when empty.
+    // O(logn) expected
+    //
+    T peek() const {
+        const T* value = peek_ref();
+        return value ? *value : T{};
+    }
+
+    const T* peek_ref() const {
+        const NODE* node = _first(root.get());
+        return node == nullptr ? nullptr : &node->value;
+    }
+
+    bool peek_priority(int& priority) const {
+        const NODE* node = _first(root.get());
+        if (node == nullptr) {
+            return false;
+        }
+        priority = node->priority;
+        return true;
+    }
+
+
+    //
+    // size:
+    //
+    // O(1)
+    //
+    int size() const {
+        return sz;
+    }
+
+
+    //
+    // for_each:
+    //
+    // Calls fn(value, priority) for every element in priority order.  The
+    // version cannot change underneath the traversal.
+    // O(n)
+    //
+    template<typename Fn>
+    void for_each(Fn fn) const {
+        vector<const NODE*> pending;
+        const NODE* node = root.get();
+        while (node != nullptr || !pending.empty()) {
+            while (node != nullptr) {
+                pending.push_back(node);
+                node = node->left.get();
+            }
+            node = pending.back();
+            pending.pop_back();
+            fn(node->value, node->priority);
+            node = node->right.get();
+        }
+    }
+
+
+    //
+    // toString:
+    //
+    // Same format as prqueue::toString.
+    // O(n)
+    //
+    string toString() const {
+        stringstream ss;
+        for_each([&ss](const T& value, int priority) {
+            ss << priority << " value: " << value << "\n";
+        });
+        return ss.str();
+    }
+};
@@ -15,15 +15,51 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <future>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <set>
 #include <queue>
 #include <stack>
 #include <functional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "frozenqueue.h"
+
+// Compile with -DPRQUEUE_STATS to collect operation counters and latency
+// histograms (see stats()).  Without it the PRQ_STAT hooks compile to nothing.
+#ifdef PRQUEUE_STATS
+#include "prstats.h"
+#define PRQ_STAT(stmt) stmt
+#else
+#define PRQ_STAT(stmt)
+#endif
 
 using namespace std;
 
+class node_arena;  // see arena.h, needed only by callers of set_arena
+
+// How prqueue runs its bulk operations (assign, for_each) under an
+// execution policy.  The primary template runs them on the calling
+// thread, which keeps this header free of <execution> and its parallel
+// backend.  prqueue_parallel.h specializes it for the standard parallel
+// policies: include it wherever a parallel policy is passed in.
+template<typename Policy>
+struct prqueue_policy {
+    static const bool forks = false;  // whether subtrees go to separate tasks
+
+    template<typename RandomIt, typename Less>
+    static void stable_sort(RandomIt first, RandomIt last, Less less) {
+        std::stable_sort(first, last, less);
+    }
+};
+
 template<typename T>
 class prqueue {
 private:
@@ -31,16 +67,279 @@ private:
         int priority;  // used to build BST
         T value;       // stored data for the p-queue
         bool dup;      // marked true when there are duplicate priorities
+        bool dead;     // cancelled, waiting to be unlinked (see cancel)
+        uint32_t gen;  // bumped every time the node is freed, to detect stale handles
         NODE* parent;  // links back to parent
         NODE* link;    // links to linked list of NODES with duplicate priorities
         NODE* left;    // links to left child
         NODE* right;   // links to right child
+        NODE* tail;    // last node of the duplicate chain (chain heads only)
+        int count;     // # of nodes in this subtree, duplicates and dead nodes included (chain heads only)
+        size_t hsum;   // sum of _linkHash over this subtree (chain heads only)
     };
     NODE* root; // pointer to root node of the BST
     int sz;     // # of elements in the prqueue
     NODE* curr; // pointer to next item in prqueue (see begin and next)
+    NODE* rmost; // rightmost node of the BST (lowest priority), nullptr if empty
+    int cap;     // maximum # of elements, 0 when unbounded (see set_capacity)
+    NODE* freeList;   // freed nodes, chained through link, reused by _allocNode
+    int freeCount;    // # of nodes on freeList
+    bool keepFreed;   // handles are in use: keep every freed node (see track_handles)
+    int deadCount;    // # of cancelled nodes still linked into the tree
+    vector<pair<NODE*, uint32_t>> pendingDead; // cancelled nodes (and their gen) to unlink
+    // Where new nodes come from (see set_arena): an arena and the functions
+    // set_arena bound to reach it, or the heap when a is nullptr.  Calling
+    // through the pointers keeps arena.h, with its mmap and NUMA system
+    // headers, out of this header.
+    struct ARENA {
+        node_arena* a = nullptr;
+        void* (*allocate)(node_arena*) = nullptr;
+        void (*deallocate)(node_arena*, void*) = nullptr;
+    };
+    ARENA arena;
+#ifdef PRQUEUE_STATS
+    prqueue_stats st; // counters reported by stats()
+#endif
+
+    // Predecessor hash used for the head of a duplicate chain.
+    static const uint64_t CHAIN_HEAD = 0x51ed270b27a5c3d9ULL;
+
+    // Hash of a value.  Always 0 when T has no std::hash or when compiled
+    // with PRQUEUE_NO_HASH, in which case fingerprint() only reflects the
+    // priorities of the elements.
+    static uint64_t _valueHash(const T& value) {
+#ifndef PRQUEUE_NO_HASH
+        if constexpr (requires { hash<T>{}(value); }) {
+            return (uint64_t) hash<T>{}(value);
+        }
+#endif
+        (void) value;
+        return 0;
+    }
+
+    // Hash of one element together with the element queued just before it
+    // at the same priority (CHAIN_HEAD for the first one).  Summing these
+    // makes the fingerprint depend on the FIFO order within a priority but
+    // not on the order in which different priorities were inserted.
+    static size_t _linkHash(int priority, uint64_t prev, uint64_t value) {
+        // splitmix64 finalizer so that sums of hashes do not cancel out
+        uint64_t h = value + prev * 0x9e3779b97f4a7c15ULL + (uint64_t) (unsigned) priority;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return (size_t) (h ^ (h >> 31));
+    }
+
+    // Sum of _linkHash over the duplicate chain starting at head.
+    static size_t _chainHash(NODE* head) {
+        size_t sum = 0;
+        uint64_t prev = CHAIN_HEAD;
+        for (NODE* dup = head; dup != nullptr; dup = dup->link) {
+            uint64_t h = _valueHash(dup->value);
+            sum += _linkHash(dup->priority, prev, h);
+            prev = h;
+        }
+        return sum;
+    }
+
+    // Allocates a node for value/priority with all links cleared, reusing
+    // a freed node when there is one.
+    NODE* _allocNode(T&& value, int priority) {
+        if (freeList != nullptr) {
+            PRQ_STAT(st.allocHits++);
+        } else {
+            PRQ_STAT(st.allocMisses++);
+        }
+        return _takeNode(arena, &freeList, freeCount, move(value), priority);
+    }
+
+    // Pops a node off *pool when pool is given and not empty, otherwise
+    // takes a new one (see _newNode).  The copy and bulk-build helpers pass
+    // the free list as pool on the sequential path and nullptr when they
+    // fork, so only the calling thread ever touches the list.
+    static NODE* _takeNode(const ARENA& arena, NODE** pool, int& poolCount,
+                           T&& value, int priority) {
+        if (pool != nullptr && *pool != nullptr) {
+            NODE* node = *pool;
+            *pool = node->link;
+            poolCount--;
+            _initNode(node, move(value), priority);
+            return node;
+        }
+        return _newNode(arena, move(value), priority);
+    }
+
+    // Takes a node straight from the arena, or the heap if there is none.
+    // Unlike _allocNode it touches no member state, so the parallel
+    // builders may call it from many threads.
+    static NODE* _newNode(const ARENA& arena, T&& value, int priority) {
+        NODE* node = arena.a != nullptr ? new (arena.allocate(arena.a)) NODE : new NODE;
+        node->gen = 0;
+        _initNode(node, move(value), priority);
+        return node;
+    }
+
+    // Gives a fresh or recycled node its contents and clears its links.
+    static void _initNode(NODE* node, T&& value, int priority) {
+        node->priority = priority;
+        node->value = move(value);
+        node->dup = false;
+        node->dead = false;
+        node->parent = nullptr;
+        node->link = nullptr;
+        node->left = nullptr;
+        node->right = nullptr;
+        node->tail = node;
+        node->count = 1;
+        node->hsum = 0;
+    }
+
+    // Subtree element count and fingerprint of a possibly null subtree.
+    static int _count(const NODE* node) {
+        return node == nullptr ? 0 : node->count;
+    }
+
+    static size_t _hsum(const NODE* node) {
+        return node == nullptr ? 0 : node->hsum;
+    }
+
+    // # of elements in the duplicate chain headed by tree node head.
+    static int _chainCount(const NODE* head) {
+        return head->count - _count(head->left) - _count(head->right);
+    }
+
+    // Recomputes the augmented fields of head from its children, given the
+    // size and fingerprint of its own duplicate chain.
+    static void _pull(NODE* head, int chainCount, size_t chainSum) {
+        head->count = chainCount + _count(head->left) + _count(head->right);
+        head->hsum = chainSum + _hsum(head->left) + _hsum(head->right);
+    }
+
+    // Returns the rightmost node of a possibly null subtree.
+    static NODE* _findLastNode(NODE* node) {
+        while (node != nullptr && node->right != nullptr) {
+            node = node->right;
+        }
+        return node;
+    }
+
+    // Adds dcount/dsum to the augmented fields of head and every ancestor.
+    static void _adjustUp(NODE* head, int dcount, size_t dsum) {
+        for (NODE* node = head; node != nullptr; node = node->parent) {
+            node->count += dcount;
+            node->hsum += dsum;
+        }
+    }
+
+    // Returns a node to the free list, which keeps at most
+    // max(sz, cap, FREE_KEEP) nodes; the excess goes back to the heap (or
+    // arena).  On a queue tracking handles the list is unbounded and nodes
+    // are only given back by clear, assign, shrink_to_fit, set_arena and
+    // the destructor, so between those calls a stale handle can always
+    // read the gen of the node it points to.
+    void _freeNode(NODE* node) {
+        node->gen++;
+        if constexpr (!is_trivially_destructible_v<T>) {
+            node->value = T();  // drop whatever the value holds on to
+        }
+        node->link = freeList;
+        freeList = node;
+        freeCount++;
+        if (!keepFreed) {
+            _releaseFree(max({sz, cap, FREE_KEEP}));
+        }
+    }
+
+    // Gives free-list nodes back to the heap (or arena) until at most keep
+    // are left.
+    void _releaseFree(int keep) {
+        while (freeCount > keep) {
+            NODE* node = freeList;
+            freeList = node->link;
+            freeCount--;
+            _deleteNode(arena, node);
+        }
+    }
+
+    // Gives a node back to where _newNode took it from.
+    static void _deleteNode(const ARENA& arena, NODE* node) {
+        if (arena.a != nullptr) {
+            node->~NODE();
+            arena.deallocate(arena.a, node);
+        } else {
+            delete node;
+        }
+    }
+
+    // Points parent's link to old (or root, if parent is null) at node.
+    void _replaceChild(NODE* parent, NODE* old, NODE* node) {
+        if (parent == nullptr) {
+            root = node;
+        } else if (parent->left == old) {
+            parent->left = node;
+        } else {
+            parent->right = node;
+        }
+    }
+
+    // Starts loading node's cache line without waiting for it.  A no-op
+    // for nullptr, for compilers without __builtin_prefetch, and when
+    // compiled with PRQUEUE_NO_PREFETCH (to measure what it buys).
+    static void _prefetch(const NODE* node) {
+#if defined(__GNUC__) && !defined(PRQUEUE_NO_PREFETCH)
+        __builtin_prefetch(node);
+#else
+        (void) node;
+#endif
+    }
+
+    // Prefetches what the _successor call after node will read first: the
+    // next node of its duplicate chain and its right subtree.  node is
+    // already cached, so reading its links costs nothing.
+    static void _prefetchSuccessor(const NODE* node) {
+        if (node != nullptr) {
+            _prefetch(node->link);
+            _prefetch(node->right);
+        }
+    }
+
+    // Returns node, or the first live element after it.
+    static NODE* _skipDead(NODE* node) {
+        while (node != nullptr && node->dead) {
+            node = _successor(node);
+        }
+        return node;
+    }
 
 public:
+    //
+    // handle:
+    //
+    // Identifies one enqueued element for cancel().  A handle goes stale
+    // once its element leaves the queue.  On a queue tracking handles (see
+    // track_handles) a stale handle is detected and ignored, even if the
+    // node has since been reused; otherwise a handle may only be used
+    // while its element is queued.  A default (or rejected) handle
+    // converts to false.
+    //
+    struct handle {
+        NODE* node = nullptr;
+        uint32_t gen = 0;
+
+        explicit operator bool() const {
+            return node != nullptr;
+        }
+    };
+
+    // Bytes per element, for sizing a node_arena (see set_arena).
+    static const size_t NODE_SIZE = sizeof(NODE);
+
+    // # of elements whose descents enqueue_bulk interleaves.
+    static const int BULK_GROUP = 8;
+
+    // # of freed nodes always kept for reuse, however small the queue.
+    static const int FREE_KEEP = 64;
+
+
     //
     // default constructor:
     //
@@ -51,6 +350,64 @@ public:
         root = nullptr;
         sz = 0;
         curr = nullptr;  
+        rmost = nullptr;
+        cap = 0;
+        freeList = nullptr;
+        freeCount = 0;
+        keepFreed = false;
+        deadCount = 0;
+        arena = ARENA();
+    }
+
+
+    //
+    // copy constructor:
+    //
+    // Creates a priority queue holding a copy of "other".
+    // O(n), where n is total number of nodes in custom BST
+    //
+    prqueue(const prqueue& other) : prqueue() {
+        *this = other;
+    }
+
+
+    //
+    // move constructor / move assignment:
+    //
+    // Takes over the tree of "other", leaving "other" empty.
+    // O(1) for construction, O(n) for assignment to free the old tree
+    //
+    prqueue(prqueue&& other) noexcept : prqueue() {
+        swap(other);
+    }
+
+    prqueue& operator=(prqueue&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+
+    //
+    // swap:
+    //
+    // Exchanges the contents of this priority queue and "other".
+    // O(1)
+    //
+    void swap(prqueue& other) noexcept {
+        std::swap(root, other.root);
+        std::swap(sz, other.sz);
+        std::swap(curr, other.curr);
+        std::swap(rmost, other.rmost);
+        std::swap(cap, other.cap);
+        std::swap(freeList, other.freeList);
+        std::swap(freeCount, other.freeCount);
+        std::swap(keepFreed, other.keepFreed);
+        std::swap(deadCount, other.deadCount);
+        pendingDead.swap(other.pendingDead);
+        std::swap(arena, other.arena);
     }
 
 
@@ -58,7 +415,8 @@ public:
     // operator=
     //
     // Clears "this" tree and then makes a copy of the "other" tree.
-    // Sets all member variables appropriately.
+    // Sets all member variables appropriately.  Handles into "this" do not
+    // survive the assignment (see assign).
     // O(n), where n is total number of nodes in custom BST
     //
     prqueue& operator=(const prqueue& other) {
@@ -66,46 +424,296 @@ public:
             return *this; // Handle self-assignment
         }
 
-        // If 'other' is empty, we're done
-        if (other.root == nullptr) {
-            return *this;
-        }
+        assign(other);
+        return *this;
+    }
 
-        // Traverse 'other' and enqueue its elements into 'this'
-        queue<NODE*> q;
-        q.push(other.root);
 
-        while (!q.empty()) {
-            NODE* current = q.front();
-            q.pop();
+    //
+    // assign (copy):
+    //
+    // Clears "this" tree and makes a node-for-node copy of the "other" tree,
+    // keeping its shape.  With a parallel execution policy (see
+    // prqueue_parallel.h) the top levels of the tree fork tasks, so
+    // independent subtrees are copied on different threads.  The sequential copy reuses the nodes of the old
+    // contents first; afterwards at most max(size(), capacity()) nodes are
+    // kept for reuse, so repeatedly copying into the same queue does not
+    // grow it.  Handles into "this" do not survive the call.
+    // O(n) work, O(n / threads + depth) span for balanced trees
+    //
+    void assign(const prqueue& other) {
+        assign(SEQ(), other);
+    }
 
-            // Enqueue the current node's value
-            enqueue(current->value, current->priority);
+    template<typename Policy>
+    void assign(Policy&& policy, const prqueue& other) {
+        (void) policy;
+        if (this == &other) {
+            return;
+        }
+        if (other.deadCount > 0) {
+            // Copy only the live elements; the copy starts out compacted.
+            // Take the capacity first so the build trims against it.
+            vector<pair<T, int>> items;
+            other.for_each([&items](const T& value, int priority) {
+                items.emplace_back(value, priority);
+            });
+            cap = other.cap;
+            assign(policy, items.begin(), items.end());
+            return;
+        }
+        NODE** pool = _clearForBuild<Policy>();
+        PRQ_STAT(int before = freeCount);
+        root = _cloneRecursive(arena, pool, freeCount, other.root, nullptr,
+                               _forkDepth<Policy>());
+        rmost = _findLastNode(root);
+        sz = other.sz;
+        cap = other.cap;
+        PRQ_STAT(st.allocHits += before - freeCount);
+        PRQ_STAT(st.allocMisses += sz - (before - freeCount));
+        _releaseFree(max(sz, cap));
+    }
+
+
+    //
+    // assign (bulk build):
+    //
+    // Clears "this" tree and fills it with the (value, priority) pairs of
+    // [first, last), e.g. a vector<pair<T, int>>.  The input is stably
+    // sorted by priority (in parallel with a parallel policy), equal
+    // priorities become duplicate chains in input order, and the unique
+    // priorities are built into a perfectly balanced tree whose top-level
+    // subtrees are constructed by separate tasks.  Nodes are reused and
+    // released as for the copying assign, and handles into "this" do not
+    // survive the call.
+    // O(n logn) for the sort plus O(n) to build
+    //
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        assign(SEQ(), first, last);
+    }
 
-            // Enqueue left and right children (if they exist)
-            if (current->left) {
-                q.push(current->left);
+    template<typename Policy, typename InputIt>
+    void assign(Policy&& policy, InputIt first, InputIt last) {
+        (void) policy;
+        vector<pair<T, int>> items(first, last);
+        NODE** pool = _clearForBuild<Policy>();
+        PRQ_STAT(int before = freeCount);
+
+        prqueue_policy<remove_cvref_t<Policy>>::stable_sort(items.begin(), items.end(),
+            [](const pair<T, int>& a, const pair<T, int>& b) { return a.second < b.second; });
+
+        // starts[i] is the index of the first item of the i-th priority.
+        vector<size_t> starts;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (i == 0 || items[i].second != items[i - 1].second) {
+                starts.push_back(i);
             }
-            if (current->right) {
-                q.push(current->right);
+        }
+        starts.push_back(items.size());
+
+        root = _buildRecursive(arena, pool, freeCount, items, starts, 0, starts.size() - 1,
+                               nullptr, _forkDepth<Policy>());
+        rmost = _findLastNode(root);
+        sz = (int) items.size();
+        PRQ_STAT(st.allocHits += before - freeCount);
+        PRQ_STAT(st.allocMisses += sz - (before - freeCount));
+        _trimToCapacity();
+        _releaseFree(max(sz, cap));
+    }
+
+    // Private helper emptying the tree before a rebuild and returning the
+    // pool the builders may take nodes from: the free list on the
+    // sequential path, nothing when they fork (the free list is then
+    // released down to the capacity first).
+    template<typename Policy>
+    NODE** _clearForBuild() {
+        _clearTree();
+        if (_forkDepth<Policy>() > 0) {
+            _releaseFree(cap);
+            return nullptr;
+        }
+        return &freeList;
+    }
+
+
+    //
+    // for_each:
+    //
+    // Calls fn(value, priority) for every live element.  Without a policy,
+    // or with a sequential one, the calls happen in priority order on the
+    // calling thread.  With a parallel policy (see prqueue_parallel.h) the
+    // tree is partitioned into subtrees that are visited by separate
+    // threads, so fn must be safe to call concurrently and sees no
+    // particular order.  The queue must not be modified while for_each
+    // runs.
+    // O(n)
+    //
+    template<typename Fn>
+    void for_each(Fn fn) const {
+        for_each(SEQ(), fn);
+    }
+
+    template<typename Policy, typename Fn>
+    void for_each(Policy&& policy, Fn fn) const {
+        (void) policy;
+        _forEachRecursive(root, fn, _forkDepth<Policy>());
+    }
+
+    //
+    // freeze:
+    //
+    // Returns an immutable snapshot of the live elements stored in one
+    // contiguous array, with a van Emde Boas ordered search index (see
+    // frozenqueue.h).  Meant for large, read-mostly snapshots that many
+    // readers scan and range-query; the queue itself is unchanged.
+    // O(n)
+    //
+    frozen_prqueue<T> freeze() const {
+        vector<pair<T, int>> items;
+        items.reserve(sz);
+        for_each([&items](const T& value, int priority) {
+            items.emplace_back(value, priority);
+        });
+        return frozen_prqueue<T>(move(items));
+    }
+
+
+    // Policy of the overloads without one.
+    struct SEQ {};
+
+    // # of recursion levels that fork a task: none for sequential policies,
+    // otherwise enough to give every hardware thread a few subtrees.
+    template<typename Policy>
+    static int _forkDepth() {
+        if constexpr (!prqueue_policy<remove_cvref_t<Policy>>::forks) {
+            return 0;
+        } else {
+            unsigned tasks = thread::hardware_concurrency() * 4;
+            int depth = 0;
+            while ((1u << depth) < tasks) {
+                depth++;
             }
+            return depth;
+        }
+    }
 
-            // Enqueue linked list nodes with the same priority
-            NODE* linkNode = current->link;
-            while (linkNode) {
-                enqueue(linkNode->value, linkNode->priority);
-                linkNode = linkNode->link;
+    // Recursive helper copying the subtree at src, duplicates included.
+    static NODE* _cloneRecursive(const ARENA& arena, NODE** pool, int& poolCount,
+                                 const NODE* src, NODE* parent, int forkDepth) {
+        if (src == nullptr) {
+            return nullptr;
+        }
+
+        NODE* copy = _takeNode(arena, pool, poolCount, T(src->value), src->priority);
+        copy->dup = src->dup;
+        copy->parent = parent;
+        copy->count = src->count;
+        copy->hsum = src->hsum;
+        NODE* tail = copy;
+        for (const NODE* dup = src->link; dup != nullptr; dup = dup->link) {
+            NODE* node = _takeNode(arena, pool, poolCount, T(dup->value), dup->priority);
+            node->dup = true;
+            node->parent = tail;
+            tail->link = node;
+            tail = node;
+        }
+        copy->tail = tail;
+
+        if (forkDepth > 0 && src->left != nullptr && src->right != nullptr) {
+            auto left = async(launch::async, [=, &poolCount]() {
+                return _cloneRecursive(arena, pool, poolCount, src->left, copy, forkDepth - 1);
+            });
+            copy->right = _cloneRecursive(arena, pool, poolCount, src->right, copy,
+                                          forkDepth - 1);
+            copy->left = left.get();
+        } else {
+            copy->left = _cloneRecursive(arena, pool, poolCount, src->left, copy,
+                                         forkDepth - 1);
+            copy->right = _cloneRecursive(arena, pool, poolCount, src->right, copy,
+                                          forkDepth - 1);
+        }
+        return copy;
+    }
+
+    // Recursive helper building a balanced tree over the priorities
+    // starts[lo, hi) of the sorted items.
+    static NODE* _buildRecursive(const ARENA& arena, NODE** pool, int& poolCount,
+                                 const vector<pair<T, int>>& items,
+                                 const vector<size_t>& starts, size_t lo, size_t hi,
+                                 NODE* parent, int forkDepth) {
+        if (lo >= hi) {
+            return nullptr;
+        }
+
+        size_t mid = lo + (hi - lo) / 2;
+        NODE* head = nullptr;
+        NODE* tail = nullptr;
+        for (size_t i = starts[mid]; i < starts[mid + 1]; i++) {
+            NODE* node = _takeNode(arena, pool, poolCount, T(items[i].first), items[i].second);
+            if (head == nullptr) {
+                head = node;
+                node->parent = parent;
+            } else {
+                node->dup = true;
+                node->parent = tail;
+                tail->link = node;
+                head->dup = true;
             }
+            tail = node;
+        }
+        head->tail = tail;
+        if (forkDepth > 0 && hi - lo > 2) {
+            auto left = async(launch::async, [&, head]() {
+                return _buildRecursive(arena, pool, poolCount, items, starts, lo, mid, head,
+                                       forkDepth - 1);
+            });
+            head->right = _buildRecursive(arena, pool, poolCount, items, starts, mid + 1, hi,
+                                          head, forkDepth - 1);
+            head->left = left.get();
+        } else {
+            head->left = _buildRecursive(arena, pool, poolCount, items, starts, lo, mid, head,
+                                         forkDepth - 1);
+            head->right = _buildRecursive(arena, pool, poolCount, items, starts, mid + 1, hi,
+                                          head, forkDepth - 1);
         }
+        _pull(head, (int) (starts[mid + 1] - starts[mid]), _chainHash(head));
+        return head;
+    }
 
-        return *this;
+    // Recursive helper for for_each.
+    template<typename Fn>
+    static void _forEachRecursive(NODE* node, Fn& fn, int forkDepth) {
+        if (node == nullptr) {
+            return;
+        }
+
+        future<void> left;
+        if (forkDepth > 0 && node->left != nullptr && node->right != nullptr) {
+            left = async(launch::async, [&fn, node, forkDepth]() {
+                _forEachRecursive(node->left, fn, forkDepth - 1);
+            });
+        } else {
+            _forEachRecursive(node->left, fn, forkDepth - 1);
+        }
+        for (NODE* dup = node; dup != nullptr; dup = dup->link) {
+            if (!dup->dead) {
+                fn(dup->value, dup->priority);
+            }
+        }
+        _forEachRecursive(node->right, fn, forkDepth - 1);
+        if (left.valid()) {
+            left.get();
+        }
     }
 
 
     //
     // clear:
     //
-    // Frees the memory associated with the priority queue but is public.
+    // Removes every element and gives the nodes back to the heap (or
+    // arena), keeping only as many as a bounded queue needs to refill to
+    // its capacity.  Handles into the queue do not survive clear().
     // O(n), where n is total number of nodes in custom BST
     //
     // Recursive helper function to clear the tree
@@ -122,21 +730,32 @@ public:
         while (node->link != nullptr) {
             NODE* temp = node;
             node = node->link;
-            delete temp;
+            _freeNode(temp);
         }
 
         // Clear the current node
-        delete node;
+        _freeNode(node);
     }
 
     // Public clear method
     void clear() {
+        _clearTree();
+        _releaseFree(cap);
+    }
+
+    // Private helper moving every node of the tree to the free list and
+    // resetting the queue to empty.
+    void _clearTree() {
         // Call the recursive helper function to clear the tree
         _clearRecursive(root);
 
-        // Reset root and size
+        // Reset root, size and traversal state
         root = nullptr;
         sz = 0;
+        curr = nullptr;
+        rmost = nullptr;
+        deadCount = 0;
+        pendingDead.clear();
     }
 
 
@@ -148,8 +767,41 @@ public:
     //
     ~prqueue() {
 
-        clear();
+        _clearTree();
+        _releaseFree(0);
+    }
+
 
+    //
+    // shrink_to_fit:
+    //
+    // Gives the nodes kept for reuse back to the heap (or arena), keeping
+    // only as many as the capacity (see set_capacity) can still use.  A
+    // queue tracking handles otherwise keeps its peak node count after
+    // dequeueing, so that stale handles stay detectable; handles to
+    // elements that already left the queue must not be used after this
+    // call.
+    // O(f), where f is the # of nodes released
+    //
+    void shrink_to_fit() {
+        _releaseFree(max(cap - sz, 0));
+    }
+
+
+    //
+    // track_handles:
+    //
+    // Keeps every freed node for reuse from now on, so that handles whose
+    // element has left the queue are detected as stale by cancel() and
+    // decrease_key() (see handle).  The first cancel() or decrease_key()
+    // call turns tracking on by itself; call this earlier when a handle
+    // may go stale before then.  Otherwise the queue keeps at most
+    // max(size(), capacity(), FREE_KEEP) freed nodes, so queues that never
+    // use handles do not hold on to their peak node count.
+    // O(1)
+    //
+    void track_handles() {
+        keepFreed = true;
     }
 
 
@@ -157,47 +809,89 @@ public:
     // enqueue:
     //
     // Inserts the value into the custom BST in the correct location based on
-    // priority.
-    // O(logn + m), where n is number of unique nodes in tree and m is number 
-    // of duplicate priorities
+    // priority and returns a handle to it (see cancel).  If the queue is
+    // bounded (see set_capacity), full, and priority is no better than the
+    // current worst element, the value is rejected and a null handle is
+    // returned.
+    // O(logn), where n is number of unique nodes in tree; a rejection is O(1)
     //
-    void enqueue(T value, int priority) {
-        // Create a new node with the provided value and priority.
-        NODE* newNode = new NODE;
-        newNode->priority = priority;
-        newNode->value = value;
-        newNode->dup = false;
-        newNode->parent = nullptr;
-        newNode->link = nullptr;
-        newNode->left = nullptr;
-        newNode->right = nullptr;
+    handle enqueue(T value, int priority) {
+        PRQ_STAT(st.enqueues++);
+        PRQ_STAT(latency_histogram::timer timer(st.enqueueLatency));
+        _compactStep();
+
+        // Create a new node with the provided value and priority.  A full
+        // bounded queue evicts its worst element and reuses that node.
+        NODE* newNode;
+        if (cap > 0 && sz >= cap) {
+            _purgeMax();
+            if (priority >= rmost->priority) {
+                return handle();
+            }
+            newNode = _unlinkMax();
+            newNode->gen++;  // invalidate handles to the evicted element
+            _initNode(newNode, move(value), priority);
+            PRQ_STAT(st.allocHits++);
+        } else {
+            newNode = _allocNode(move(value), priority);
+        }
+        handle h;
+        h.node = newNode;
+        h.gen = newNode->gen;
 
         // If the tree is empty, set the new node as the root.
         if (root == nullptr) {
             root = newNode;
+            rmost = newNode;
             sz = 1;
+            root->hsum = _linkHash(priority, CHAIN_HEAD, _valueHash(newNode->value));
             curr = root;
-            return;
+            PRQ_STAT(st.recordDepth(0));
+            return h;
         }
 
         // Otherwise, traverse the tree to find the correct position to insert the new node.
-        NODE* currentNode = root;
+        _insertBelow(root, newNode, 0);
+        return h;
+    }
+
+    // Links newNode (not yet in the tree) into the non-empty tree: behind
+    // the elements of its priority, or as a new leaf.  The descent starts
+    // at start, at depth startDepth, which must be the root or a node on
+    // the path from the root to newNode's position.
+    void _insertBelow(NODE* start, NODE* newNode, uint64_t startDepth) {
+        int priority = newNode->priority;
+        NODE* currentNode = start;
         NODE* parent = nullptr;
+        PRQ_STAT(uint64_t depth = startDepth);
+        (void) startDepth;
 
         while (currentNode != nullptr) {
             parent = currentNode;
+            PRQ_STAT(depth++);
+
+            // Both children are fetched while this node's priority is
+            // compared, so the next level's load is already under way.
+            _prefetch(currentNode->left);
+            _prefetch(currentNode->right);
 
             // Handle duplicate priorities by creating a linked list of nodes with the same priority.
             if (priority == currentNode->priority) {
-                while (currentNode->link != nullptr) {
-                    parent = currentNode;
-                    currentNode = currentNode->link;
-                }
+                NODE* head = currentNode;
+                currentNode = head->tail;
+                PRQ_STAT(uint64_t chain = (uint64_t) _chainCount(head) + 1);
+                PRQ_STAT(st.recordDepth(depth - 1));
+                PRQ_STAT(st.descents++);
+                PRQ_STAT(st.descentNodes += depth);
+                PRQ_STAT(st.longestChain = chain > st.longestChain ? chain : st.longestChain);
+                _adjustUp(head, 1, _linkHash(priority, _valueHash(currentNode->value),
+                                             _valueHash(newNode->value)));
                 currentNode->link = newNode;
                 newNode->link = nullptr;  // Connect the new node to the end of the linked list.
-                newNode->parent = parent;
+                newNode->parent = currentNode;  // Chain nodes link back to their predecessor.
                 newNode->dup = true;
                 currentNode->dup = true;
+                head->tail = newNode;
                 sz++;
                 return;
             } else if (priority < currentNode->priority) {
@@ -207,6 +901,10 @@ public:
             }
         }
 
+        PRQ_STAT(st.recordDepth(depth));
+        PRQ_STAT(st.descents++);
+        PRQ_STAT(st.descentNodes += depth);
+
         // Insert the new node in the correct position.
         if (priority < parent->priority) {
             parent->left = newNode;
@@ -215,7 +913,79 @@ public:
         }
 
         newNode->parent = parent;
+        if (priority > rmost->priority) {
+            rmost = newNode;
+        }
         sz++;
+        newNode->hsum = _linkHash(priority, CHAIN_HEAD, _valueHash(newNode->value));
+        _adjustUp(parent, 1, newNode->hsum);
+    }
+
+
+    //
+    // enqueue_bulk:
+    //
+    // Enqueues every (value, priority) pair of [first, last), e.g. a
+    // vector<pair<T, int>>, in order.  Unlike a loop of enqueue calls, the
+    // descents of BULK_GROUP consecutive elements are interleaved: each
+    // round moves every element of the group one level down and
+    // prefetches the child it moves to, so the cache misses of the group
+    // overlap instead of being paid one after the other.  Elements are
+    // then linked in input order from where their descent stopped, which
+    // is still on their path because linking only ever adds leaves and
+    // chain members.  A bounded queue enqueues one element at a time, and
+    // cancelled elements are compacted away first.
+    // O(k logn) for k elements, with up to BULK_GROUP misses in flight
+    //
+    template<typename InputIt>
+    void enqueue_bulk(InputIt first, InputIt last) {
+        if (cap > 0) {
+            for (; first != last; ++first) {
+                enqueue(T(first->first), first->second);
+            }
+            return;
+        }
+        compact();
+
+        NODE* group[BULK_GROUP];
+        NODE* at[BULK_GROUP];        // where the descent of group[i] stands
+        uint64_t depth[BULK_GROUP];
+        while (first != last) {
+            int k = 0;
+            for (; k < BULK_GROUP && first != last; ++first) {
+                if (root == nullptr) {
+                    enqueue(T(first->first), first->second);
+                    continue;
+                }
+                PRQ_STAT(st.enqueues++);
+                group[k] = _allocNode(T(first->first), first->second);
+                at[k] = root;
+                depth[k] = 0;
+                k++;
+            }
+
+            for (bool moved = true; moved;) {
+                moved = false;
+                for (int i = 0; i < k; i++) {
+                    NODE* node = at[i];
+                    int priority = group[i]->priority;
+                    if (priority == node->priority) {
+                        continue;
+                    }
+                    NODE* child = priority < node->priority ? node->left : node->right;
+                    if (child != nullptr) {
+                        _prefetch(child);
+                        at[i] = child;
+                        depth[i]++;
+                        moved = true;
+                    }
+                }
+            }
+
+            for (int i = 0; i < k; i++) {
+                _insertBelow(at[i], group[i], depth[i]);
+            }
+        }
     }
 
 
@@ -228,6 +998,11 @@ public:
     // of duplicate priorities
     //
     T dequeue() {
+        PRQ_STAT(st.dequeues++);
+        PRQ_STAT(latency_histogram::timer timer(st.dequeueLatency));
+        _compactStep();
+        _purgeMin();
+
         if (root == nullptr) {
             // Handle the case when the priority queue is empty by returning a default value.
             return T{};
@@ -237,17 +1012,40 @@ public:
         NODE* prev = nullptr;
 
         // Traverse to the leftmost node to find the element with the highest priority.
+        PRQ_STAT(st.descents++);
+        PRQ_STAT(st.descentNodes++);
         while (node->left != nullptr) {
             prev = node;
             node = node->left;
+            PRQ_STAT(st.descentNodes++);
         }
 
-        T valueOut = node->value;
+        T valueOut = move(node->value);
+        if (curr == node) {
+            curr = _successor(node);
+        }
+
+        // The next duplicate, if any, becomes the head of the chain; work
+        // out how that changes the fingerprint.
+        uint64_t outHash = _valueHash(valueOut);
+        size_t dsum = 0 - _linkHash(node->priority, CHAIN_HEAD, outHash);
+        if (node->link != nullptr) {
+            uint64_t nextHash = _valueHash(node->link->value);
+            dsum -= _linkHash(node->priority, outHash, nextHash);
+            dsum += _linkHash(node->priority, CHAIN_HEAD, nextHash);
+        }
+        _adjustUp(prev, -1, dsum);
 
         // Decrease the size of the priority queue.
         sz--;
 
         if (node->dup && node->link != nullptr) {
+            node->link->count = node->count - 1;
+            node->link->hsum = node->hsum + dsum;
+            node->link->tail = node->tail;
+            if (rmost == node) {
+                rmost = node->link;
+            }
             if (node->right != nullptr) {
                 node->link->right = node->right;
                 node->right->parent = node->link;
@@ -262,7 +1060,7 @@ public:
                 node->link->parent = nullptr;
             }
 
-            delete node; // Free memory for the dequeued node.
+            _freeNode(node); // Free memory for the dequeued node.
             return valueOut;
         } 
         else {
@@ -280,13 +1078,247 @@ public:
                     root->parent = nullptr;
                 }
             }
+            if (rmost == node) {
+                rmost = nullptr; // node was the only node of the tree
+            }
 
-            delete node; // Free memory for the dequeued node.
+            _freeNode(node); // Free memory for the dequeued node.
             return valueOut;
         }
     }
 
 
+    //
+    // try_dequeue:
+    //
+    // Removes the next element and returns its value, moved out of the
+    // queue, or returns an empty optional if the queue is empty.  Unlike
+    // dequeue, an empty queue cannot be mistaken for a T{} element, so no
+    // size() check is needed first.
+    // O(logn + m), as for dequeue
+    //
+    optional<T> try_dequeue() {
+        _purgeMin();
+        if (root == nullptr) {
+            return nullopt;
+        }
+        return optional<T>(dequeue());
+    }
+
+
+    //
+    // dequeue_ready:
+    //
+    // Removes every element whose priority is <= now and writes their
+    // values to out in priority order (FIFO among equal priorities).
+    // Returns the output iterator past the last value written.  The tree is
+    // split along a single root-to-leaf path, so the elements that stay
+    // are never visited.
+    // O(logn + k), where k is the number of elements removed
+    //
+    template<typename OutputIt>
+    OutputIt dequeue_ready(int now, OutputIt out) {
+        NODE* ready = _splitAfter(now);
+
+        // Emit the ready part in order, freeing nodes as they are visited.
+        stack<NODE*> pending;
+        NODE* node = ready;
+        while (node != nullptr || !pending.empty()) {
+            while (node != nullptr) {
+                pending.push(node);
+                node = node->left;
+            }
+            node = pending.top();
+            pending.pop();
+            NODE* right = node->right;
+            while (node != nullptr) {
+                NODE* dup = node->link;
+                if (node->dead) {
+                    deadCount--;
+                } else {
+                    *out++ = move(node->value);
+                    sz--;
+                }
+                _freeNode(node);
+                node = dup;
+            }
+            node = right;
+        }
+        return out;
+    }
+
+
+    // Private helper cutting every element with priority <= bound out of
+    // the tree and returning them as a separate tree; root keeps the rest.
+    // The tree is split along a single root-to-leaf path.  The nodes on
+    // the path keep their chains but change children, so their chain sizes
+    // are remembered to fix their augmented fields afterwards.
+    NODE* _splitAfter(int bound) {
+        vector<pair<NODE*, pair<int, size_t>>> path;
+        NODE* ready = nullptr;
+        NODE* rest = nullptr;
+        NODE** readyHook = &ready;
+        NODE** restHook = &rest;
+        NODE* readyParent = nullptr;
+        NODE* restParent = nullptr;
+        NODE* node = root;
+
+        while (node != nullptr) {
+            path.push_back({node, {_chainCount(node),
+                                   node->hsum - _hsum(node->left) - _hsum(node->right)}});
+            if (node->priority <= bound) {
+                *readyHook = node;
+                node->parent = readyParent;
+                readyParent = node;
+                readyHook = &node->right;
+                node = node->right;
+            } else {
+                *restHook = node;
+                node->parent = restParent;
+                restParent = node;
+                restHook = &node->left;
+                node = node->left;
+            }
+        }
+        *readyHook = nullptr;
+        *restHook = nullptr;
+        for (size_t i = path.size(); i-- > 0;) {
+            _pull(path[i].first, path[i].second.first, path[i].second.second);
+        }
+
+        root = rest;
+        curr = nullptr;
+        if (root == nullptr) {
+            rmost = nullptr;
+        }
+        return ready;
+    }
+
+
+    //
+    // split_half:
+    //
+    // Detaches the highest-priority half of the elements and returns it as
+    // a new priority queue.  The cut is made after the element of rank
+    // (size() - 1) / 2, found through the subtree counts as in kth, and a
+    // duplicate chain is never divided, so the returned queue holds at least
+    // half of the elements and more when that element's chain continues
+    // past the middle (all of them if they share one priority).  Every
+    // element left behind has a priority no better than the ones returned,
+    // so the split keeps both queues ordered.  Used by work stealing to
+    // hand a batch of urgent work to an idle thread.
+    // O(logn) for the descent and the cut, plus compaction of cancelled
+    // elements first so the counts are exact
+    //
+    prqueue split_half() {
+        compact();
+        prqueue out;
+        if (root == nullptr) {
+            return out;
+        }
+
+        // Priority of the element of rank k, the last one to hand out.
+        int k = (sz - 1) / 2;
+        NODE* node = root;
+        while (true) {
+            int before = _count(node->left);
+            if (k < before) {
+                node = node->left;
+            } else if (k < before + _chainCount(node)) {
+                break;
+            } else {
+                k -= before + _chainCount(node);
+                node = node->right;
+            }
+        }
+        NODE* part = _splitAfter(node->priority);
+
+        out.arena = arena;
+        out.root = part;
+        out.rmost = _findLastNode(part);
+        out.sz = part->count;
+        sz -= out.sz;
+        curr = nullptr;
+        return out;
+    }
+
+
+    //
+    // set_capacity / capacity:
+    //
+    // Bounds the queue to at most capacity elements (0 means unbounded,
+    // the default).  A full bounded queue keeps the best elements: enqueue
+    // rejects anything no better than the current worst element in O(1),
+    // and otherwise evicts the worst one (newest first among equal
+    // priorities) and reuses its node, so a queue that stays full performs
+    // no allocations.  To track the top-k highest scores, enqueue with
+    // priority = -score.  Shrinking the capacity evicts the excess.
+    // O(1), plus O(logn) per evicted element
+    //
+    void set_capacity(int capacity) {
+        cap = capacity < 0 ? 0 : capacity;
+        _trimToCapacity();
+    }
+
+    int capacity() const {
+        return cap;
+    }
+
+
+    //
+    // set_arena / get_arena:
+    //
+    // Takes new nodes from arena (nullptr: the heap) from now on, e.g. a
+    // node_arena bound to the NUMA node of the threads using this queue.
+    // Only possible while the queue is empty and when the arena's blocks
+    // can hold a node (NODE_SIZE bytes); returns false otherwise.  Nodes
+    // kept for reuse are released first, so handles obtained before the
+    // call must not be used after it.  The arena must outlive the queue
+    // and every queue split off it (see split_half).  Copies do not
+    // inherit the arena.  Include arena.h to pass a node_arena.
+    // O(f), where f is the # of nodes kept for reuse
+    //
+    template<typename Arena>
+    bool set_arena(Arena* a) {
+        static_assert(is_same_v<Arena, node_arena>, "set_arena takes a node_arena");
+        if (a == nullptr) {
+            return set_arena(nullptr);
+        }
+        if (root != nullptr || a->block_size() < NODE_SIZE) {
+            return false;
+        }
+        _releaseFree(0);
+        arena.a = a;
+        arena.allocate = [](node_arena* p) -> void* {
+            return static_cast<Arena*>(p)->allocate();
+        };
+        arena.deallocate = [](node_arena* p, void* block) {
+            static_cast<Arena*>(p)->deallocate(block);
+        };
+        return true;
+    }
+
+    bool set_arena(nullptr_t) {
+        if (root != nullptr) {
+            return false;
+        }
+        _releaseFree(0);
+        arena = ARENA();
+        return true;
+    }
+
+    node_arena* get_arena() const {
+        return arena.a;
+    }
+
+    // Private helper evicting worst elements until the size fits cap.
+    void _trimToCapacity() {
+        while (cap > 0 && sz > cap) {
+            _freeNode(_unlinkMax());
+        }
+    }
+
+
     //
     // Size:
     //
@@ -317,6 +1349,7 @@ public:
         while (curr && curr->left) {
             curr = curr->left;
         }
+        curr = _skipDead(curr);
     }
 
 
@@ -328,16 +1361,15 @@ public:
     //
     // False is returned when the internal state has reached null,
     // meaning no more values/priorities are available.  This is the end of the
-    // inorder traversal. True is returned in all other cases as the inertnal
-    // state has not reached the end of the priority queue. 
-    //
-    // Therefore, when another thing exists for future next() calls, 
-    // true would be returned, when future next() calls would be invalid.
-    // false would be returned.
+    // inorder traversal. True is returned in all other cases, i.e. whenever
+    // value and priority were filled in.
     //
     // O(?) - hard to say.  But approximately O(logn + m).  Definitely not O(n).
     //
     bool next(T& value, int& priority) {
+        // Cancelled elements are skipped.
+        curr = _skipDead(curr);
+
         // If the current node is null, there are no more values to return.
         if (!curr) {
             return false;
@@ -346,42 +1378,237 @@ public:
         value = curr->value;
         priority = curr->priority;
 
+        curr = _successor(curr);
+        _prefetchSuccessor(curr);
+        return true;
+    }
+
+    // Private helper returning the element that follows node in priority
+    // order, or nullptr if node is the last one.  node may be a tree node or
+    // a member of a duplicate chain.
+    static NODE* _successor(NODE* node) {
         // Check if there is a linked list of nodes with the same priority.
-        if (curr->link) {
-            curr = curr->link;
-            return true;
+        if (node->link) {
+            return node->link;
         }
 
-        // When there are no more linked list nodes with the same priority, we need to
-        // find the next node to visit in the BST structure.
-        while (curr->parent && curr->priority == curr->parent->priority) {
-            curr = curr->parent;
+        // Climb back to the head of the duplicate chain, which is the node
+        // that actually sits in the BST.
+        while (node->parent && node->priority == node->parent->priority) {
+            node = node->parent;
         }
 
-         // Step 1: Check if there is a right child.
-        if (curr->right) {
-            curr = curr->right;
-            // Traverse all the way left to find the next node with the lowest priority
-            // in the right subtree.
-            while (curr->left) {
-                curr = curr->left;
+        // Step 1: the successor is the leftmost node of the right subtree.
+        if (node->right) {
+            node = node->right;
+            while (node->left) {
+                node = node->left;
             }
-            return true;
+            return node;
+        }
+
+        // Step 2: otherwise it is the first ancestor we reach from its left.
+        while (node->parent && node->parent->priority < node->priority) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+
+    //
+    // iterator:
+    //
+    // Read-only forward iterator over the live elements in priority order
+    // (FIFO among equal priorities).  A default-constructed iterator marks
+    // the end.  Iterators to an element stay valid until that element is
+    // removed; an element that is cancelled while an iterator points at it
+    // is still returned.
+    //
+    class iterator {
+    private:
+        NODE* node;
+
+    public:
+        iterator(NODE* n = nullptr) : node(_skipDead(n)) {}
+
+        const T& operator*() const {
+            return node->value;
         }
 
-        // Step 2: If there's no right child, backtrack to the parent and continue
-        // checking for higher-priority nodes.
-        while (curr->parent) {
-            if (curr->parent->priority > curr->priority) {
-                curr = curr->parent;
-                return true;
+        const T* operator->() const {
+            return &node->value;
+        }
+
+        int priority() const {
+            return node->priority;
+        }
+
+        iterator& operator++() {
+            node = _skipDead(_successor(node));
+            _prefetchSuccessor(node);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            node = _skipDead(_successor(node));
+            return old;
+        }
+
+        bool operator==(const iterator& other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return node != other.node;
+        }
+    };
+
+    //
+    // range_view:
+    //
+    // A [first, last) pair of iterators usable in a range-based for loop.
+    //
+    struct range_view {
+        iterator first;
+        iterator last;
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+    };
+
+
+    //
+    // lower_bound / upper_bound:
+    //
+    // Return an iterator to the first element whose priority is >= priority
+    // (lower_bound) or > priority (upper_bound), or the end iterator if
+    // there is none.
+    // O(logn), where n is number of unique nodes in tree
+    //
+    iterator lower_bound(int priority) const {
+        return iterator(_firstAtLeast(priority, false));
+    }
+
+    iterator upper_bound(int priority) const {
+        return iterator(_firstAtLeast(priority, true));
+    }
+
+    // Private helper finding the first chain head with priority >= bound
+    // (> bound when strict).
+    NODE* _firstAtLeast(int bound, bool strict) const {
+        NODE* node = root;
+        NODE* best = nullptr;
+        while (node != nullptr) {
+            if (node->priority > bound || (!strict && node->priority == bound)) {
+                best = node;
+                node = node->left;
+            } else {
+                node = node->right;
             }
-            curr = curr->parent;
         }
+        return best;
+    }
+
 
-         // If we reach this point without returning true, it means we've traversed the entire BST, 
-         // and there are no more higher-priority nodes.
-        return false;
+    //
+    // range:
+    //
+    // Returns the elements whose priority lies in [lo, hi), in order.
+    // O(logn) to find the bounds, then O(1) amortized per element visited
+    //
+    range_view range(int lo, int hi) const {
+        if (hi <= lo) {
+            return range_view{iterator(), iterator()};
+        }
+        return range_view{lower_bound(lo), lower_bound(hi)};
+    }
+
+
+    //
+    // count_range:
+    //
+    // Returns the # of elements whose priority lies in [lo, hi) using the
+    // subtree counts kept in every node.  The counts include cancelled
+    // elements, so pending tombstones are compacted first.
+    // O(logn), where n is number of unique nodes in tree, plus compaction
+    //
+    int count_range(int lo, int hi) {
+        compact();
+        if (hi <= lo) {
+            return 0;
+        }
+        return _countLess(hi) - _countLess(lo);
+    }
+
+    // Private helper returning the # of elements with priority < bound.
+    int _countLess(int bound) const {
+        int count = 0;
+        NODE* node = root;
+        while (node != nullptr) {
+            if (node->priority < bound) {
+                count += node->count - _count(node->right);
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return count;
+    }
+
+
+    //
+    // kth:
+    //
+    // Returns an iterator to the element that dequeue would return after k
+    // others (k = 0 is the next element), or the end iterator if k is out
+    // of range.  kth(size() * 99 / 100) is the 99th-percentile element.
+    // O(logn + m), where m is the length of the duplicate chain landed in,
+    // plus compaction as for count_range
+    //
+    iterator kth(int k) {
+        compact();
+        if (k < 0 || k >= sz) {
+            return iterator();
+        }
+        NODE* node = root;
+        while (node != nullptr) {
+            int before = _count(node->left);
+            int chain = _chainCount(node);
+            if (k < before) {
+                node = node->left;
+            } else if (k < before + chain) {
+                for (k -= before; k > 0; k--) {
+                    node = node->link;
+                }
+                return iterator(node);
+            } else {
+                k -= before + chain;
+                node = node->right;
+            }
+        }
+        return iterator();
+    }
+
+
+    //
+    // rank:
+    //
+    // Returns the # of elements with a priority strictly better (smaller)
+    // than priority, i.e. how many elements dequeue would return before an
+    // element enqueued now with that priority would be reached, ignoring
+    // duplicates of the same priority.
+    // O(logn), where n is number of unique nodes in tree, plus compaction as
+    // for count_range
+    //
+    int rank(int priority) {
+        compact();
+        return _countLess(priority);
     }
 
 
@@ -408,10 +1635,12 @@ public:
             NODE* current = node;
             while (current) {
                 //cout << current->priority << " value: " << current->value << endl;
-                output << current->priority << " value: " << current->value << "\n";
+                if (!current->dead) {
+                    output << current->priority << " value: " << current->value << "\n";
+                }
                 current = current->link;
             }
-        } else {
+        } else if (!node->dead) {
             output << node->priority << " value: " << node->value << "\n";
         }
 
@@ -441,6 +1670,10 @@ public:
     // of duplicate priorities
     //
     T peek() {
+        PRQ_STAT(st.peeks++);
+        PRQ_STAT(latency_histogram::timer timer(st.peekLatency));
+        _purgeMin();
+
         // Use a helper function to find the first node with the highest priority.
         NODE* firstNode = _findFirstNode(root);
 
@@ -452,8 +1685,42 @@ public:
         }
     }
 
+    //
+    // peek_ref:
+    //
+    // Returns a pointer to the value of the next element without copying it,
+    // or nullptr if the queue is empty.  The pointer is valid until that
+    // element is removed.
+    // O(logn), where n is number of unique nodes in tree
+    //
+    const T* peek_ref() {
+        PRQ_STAT(st.peeks++);
+        _purgeMin();
+        NODE* firstNode = _findFirstNode(root);
+        return firstNode == nullptr ? nullptr : &firstNode->value;
+    }
+
+    //
+    // peek_priority:
+    //
+    // Stores the priority of the next element in the priority queue in
+    // "priority" and returns true, or returns false if the queue is empty.
+    // O(logn), where n is number of unique nodes in tree
+    //
+    bool peek_priority(int& priority) {
+        PRQ_STAT(st.peeks++);
+        _purgeMin();
+        NODE* firstNode = _findFirstNode(root);
+
+        if (firstNode == nullptr) {
+            return false;
+        }
+        priority = firstNode->priority;
+        return true;
+    }
+
     // Private helper function to find the first node (leftmost node) with the highest priority.
-    NODE* _findFirstNode(NODE* node) {
+    static NODE* _findFirstNode(NODE* node) {
         if (node == nullptr) {
             return nullptr;  // The priority queue is empty.
         }
@@ -467,12 +1734,327 @@ public:
     }
 
 
+    //
+    // peek_max:
+    //
+    // returns the value of the element with the lowest priority (largest
+    // priority number) without removing it.  Among equal priorities this is
+    // the most recently enqueued one, i.e. the one dequeue_max removes.
+    // O(1)
+    //
+    T peek_max() {
+        PRQ_STAT(st.peeks++);
+        _purgeMax();
+        if (rmost == nullptr) {
+            return T{};
+        }
+        return rmost->tail->value;
+    }
+
+
+    //
+    // dequeue_max:
+    //
+    // returns the value of the element with the lowest priority and removes
+    // it from the priority queue.  Duplicates leave from the tail of their
+    // chain, so the most recent arrival is dropped first.  Intended for
+    // shedding load from the back of the queue.
+    // O(1) to find and unlink the element, plus O(d) to update the subtree
+    // counts of its d ancestors
+    //
+    T dequeue_max() {
+        PRQ_STAT(st.dequeues++);
+        _purgeMax();
+        if (rmost == nullptr) {
+            return T{};
+        }
+
+        NODE* node = _unlinkMax();
+        T valueOut = move(node->value);
+        _freeNode(node);
+        return valueOut;
+    }
+
+    // Private helper unlinking the element dequeue_max would return and
+    // handing back its node without freeing it.  The tree must not be
+    // empty; the node unlinked may be a cancelled one.
+    NODE* _unlinkMax() {
+        NODE* head = rmost;
+        NODE* node = head->tail;
+        if (node->dead) {
+            deadCount--;
+        } else {
+            sz--;
+        }
+        if (curr == node) {
+            curr = nullptr;
+        }
+
+        if (node != head) {
+            // Pop the tail of the duplicate chain.
+            NODE* prev = node->parent;
+            _adjustUp(head, -1, 0 - _linkHash(node->priority, _valueHash(prev->value),
+                                              _valueHash(node->value)));
+            prev->link = nullptr;
+            head->tail = prev;
+            return node;
+        }
+
+        // The rightmost node has no right child: its left subtree (if any)
+        // takes its place, and the new maximum is the rightmost node of that
+        // subtree or else the parent.
+        NODE* parent = head->parent;
+        NODE* left = head->left;
+        _adjustUp(parent, -1, 0 - head->hsum + _hsum(left));
+        if (left != nullptr) {
+            left->parent = parent;
+        }
+        if (parent != nullptr) {
+            parent->right = left;
+        } else {
+            root = left;
+        }
+        rmost = (left != nullptr) ? _findLastNode(left) : parent;
+        return head;
+    }
+
+
+    //
+    // cancel:
+    //
+    // Removes the element identified by h (see enqueue) and returns true, or
+    // returns false if h is null or stale, i.e. its element has already left
+    // the queue.  The element is only marked dead: dequeue, peek, next,
+    // iterators and the other readers skip it from then on, and size()
+    // drops at once.  Dead nodes are unlinked and recycled a couple at a
+    // time by later operations once they make up over a quarter of the
+    // tree, so a burst of cancels does not stall any single call.  h must
+    // come from this queue (elements moved out by split_half belong to the
+    // returned queue).  Turns on handle tracking (see track_handles).
+    // O(1) to cancel; unlinking costs O(logn) per node, spread over later
+    // operations
+    //
+    bool cancel(handle h) {
+        keepFreed = true;
+        NODE* node = h.node;
+        if (node == nullptr || node->gen != h.gen || node->dead) {
+            return false;
+        }
+        node->dead = true;
+        sz--;
+        deadCount++;
+        pendingDead.push_back({node, h.gen});
+        _compactStep();
+        return true;
+    }
+
+
+    //
+    // decrease_key:
+    //
+    // Moves the element of h to a better priority, behind any elements
+    // already there, and returns the handle to use from now on.  Returns h
+    // unchanged if priority is not better than the current one, and a null
+    // handle if h is null or stale.  The BST has no cheaper way to move an
+    // element than to unlink and re-insert it; pairing_heap and
+    // rank_pairing_heap (see pairingheap.h) do this in O(1) amortized.
+    // Turns on handle tracking (see track_handles).
+    // O(logn + m)
+    //
+    handle decrease_key(handle h, int priority) {
+        keepFreed = true;
+        NODE* node = h.node;
+        if (node == nullptr || node->gen != h.gen || node->dead) {
+            return handle();
+        }
+        if (priority >= node->priority) {
+            return h;
+        }
+        _unlinkNode(node);
+        T value = move(node->value);
+        _freeNode(node);
+        return enqueue(move(value), priority);
+    }
+
+
+    //
+    // compact:
+    //
+    // Unlinks and recycles every cancelled element now.  Called by the
+    // operations that need exact subtree counts.
+    // O(d logn), where d is the number of cancelled elements
+    //
+    void compact() {
+        while (deadCount > 0 && !pendingDead.empty()) {
+            _compactOne();
+        }
+        pendingDead.clear();
+    }
+
+    // Private helper doing a bounded amount of compaction when the dead
+    // ratio is above the threshold.
+    void _compactStep() {
+        if (deadCount == 0) {
+            pendingDead.clear();
+            return;
+        }
+        if (deadCount * 4 > sz + deadCount) {
+            for (int i = 0; i < 2 && !pendingDead.empty(); i++) {
+                _compactOne();
+            }
+        } else if (pendingDead.size() > 2 * (size_t) deadCount + 16) {
+            // Mostly entries whose nodes dequeue already purged: drop them.
+            erase_if(pendingDead, [](const pair<NODE*, uint32_t>& e) {
+                return e.first->gen != e.second || !e.first->dead;
+            });
+        }
+    }
+
+    // Private helper unlinking the most recently cancelled node, if it is
+    // still in the tree.
+    void _compactOne() {
+        auto [node, gen] = pendingDead.back();
+        pendingDead.pop_back();
+        if (node->gen == gen && node->dead) {
+            _unlinkNode(node);
+            _freeNode(node);
+        }
+    }
+
+    // Private helpers unlinking cancelled elements from the front (back) of
+    // the queue, so that the minimum (maximum) is live.
+    void _purgeMin() {
+        NODE* node = _findFirstNode(root);
+        while (node != nullptr && node->dead) {
+            _unlinkNode(node);
+            _freeNode(node);
+            node = _findFirstNode(root);
+        }
+    }
+
+    void _purgeMax() {
+        while (rmost != nullptr && rmost->tail->dead) {
+            _freeNode(_unlinkMax());
+        }
+    }
+
+    // Private helper unlinking any node, chain member or tree node, and
+    // handing it back without freeing it.
+    void _unlinkNode(NODE* x) {
+        if (curr == x) {
+            curr = _successor(x);
+        }
+        if (x->dead) {
+            deadCount--;
+        } else {
+            sz--;
+        }
+
+        int p = x->priority;
+        NODE* parent = x->parent;
+        uint64_t h = _valueHash(x->value);
+
+        if (parent != nullptr && parent->priority == p) {
+            // A chain member: parent is its predecessor in the chain.
+            NODE* head = parent;
+            while (head->parent != nullptr && head->parent->priority == p) {
+                head = head->parent;
+            }
+            uint64_t prevHash = _valueHash(parent->value);
+            size_t dsum = 0 - _linkHash(p, prevHash, h);
+            if (x->link != nullptr) {
+                uint64_t nextHash = _valueHash(x->link->value);
+                dsum -= _linkHash(p, h, nextHash);
+                dsum += _linkHash(p, prevHash, nextHash);
+                x->link->parent = parent;
+            } else {
+                head->tail = parent;
+            }
+            parent->link = x->link;
+            head->dup = head->link != nullptr;
+            _adjustUp(head, -1, dsum);
+            return;
+        }
+
+        if (x->link != nullptr) {
+            // A chain head: the next duplicate takes its place in the tree.
+            NODE* next = x->link;
+            uint64_t nextHash = _valueHash(next->value);
+            size_t dsum = 0 - _linkHash(p, CHAIN_HEAD, h) - _linkHash(p, h, nextHash)
+                          + _linkHash(p, CHAIN_HEAD, nextHash);
+            next->left = x->left;
+            next->right = x->right;
+            if (next->left != nullptr) {
+                next->left->parent = next;
+            }
+            if (next->right != nullptr) {
+                next->right->parent = next;
+            }
+            next->parent = parent;
+            _replaceChild(parent, x, next);
+            next->tail = x->tail;
+            next->count = x->count - 1;
+            next->hsum = x->hsum + dsum;
+            next->dup = next->link != nullptr;
+            if (rmost == x) {
+                rmost = next;
+            }
+            _adjustUp(parent, -1, dsum);
+            return;
+        }
+
+        // A tree node without duplicates: ordinary BST deletion.
+        size_t term = _linkHash(p, CHAIN_HEAD, h);
+        if (x->left == nullptr || x->right == nullptr) {
+            NODE* child = x->left != nullptr ? x->left : x->right;
+            if (child != nullptr) {
+                child->parent = parent;
+            }
+            _replaceChild(parent, x, child);
+            if (rmost == x) {
+                rmost = child != nullptr ? _findLastNode(child) : parent;
+            }
+        } else {
+            // Two children: the in-order successor s, with its chain, moves
+            // into x's place.
+            NODE* s = x->right;
+            while (s->left != nullptr) {
+                s = s->left;
+            }
+            int chainCount = _chainCount(s);
+            size_t chainSum = s->hsum - _hsum(s->right);
+            if (s != x->right) {
+                NODE* sp = s->parent;
+                sp->left = s->right;
+                if (s->right != nullptr) {
+                    s->right->parent = sp;
+                }
+                for (NODE* node = sp; node != x; node = node->parent) {
+                    node->count -= chainCount;
+                    node->hsum -= chainSum;
+                }
+                s->right = x->right;
+                s->right->parent = s;
+            }
+            s->left = x->left;
+            s->left->parent = s;
+            s->parent = parent;
+            _replaceChild(parent, x, s);
+            _pull(s, chainCount, chainSum);
+        }
+        _adjustUp(parent, -1, 0 - term);
+    }
+
+
     //
     // ==operator
     //
-    // Returns true if this priority queue as the priority queue passed in as
-    // other.  Otherwise returns false.
-    // O(n), where n is total number of nodes in custom BST
+    // Returns true if this priority queue holds the same elements, in the
+    // same priority and FIFO order, as the priority queue passed in as
+    // other.  Otherwise returns false.  Tree shapes are not compared, so
+    // queues built in different insertion orders can be equal.
+    // O(1) when sizes or fingerprints differ, otherwise O(n), where n is
+    // total number of nodes in custom BST
     //
     bool operator==(const prqueue& other) const {
         // Check if the sizes of the two priority queues are different.
@@ -480,27 +2062,63 @@ public:
             return false;
         }
 
-        // Helper function for recursive comparison.
-        function<bool(NODE*, NODE*)> areEqual = [&](NODE* leftNode, NODE* rightNode) {
-            if (!leftNode && !rightNode) {
-                return true; // Both nodes are null, indicating equality.
-            }
-            if (!leftNode || !rightNode) {
-                return false; // One node is null while the other is not, indicating inequality.
-            }
+        // Queues with different contents almost always differ in their
+        // fingerprint, which rejects them without touching the trees.  The
+        // fingerprint covers tombstones too, so it only decides when
+        // neither queue has any.
+        if (deadCount == 0 && other.deadCount == 0 && _hsum(root) != _hsum(other.root)) {
+            return false;
+        }
 
-            // Compare priorities and values of the nodes.
+        // Walk both queues in priority order in lockstep, stopping at the
+        // first element that differs.  The tree shapes do not matter.
+        NODE* leftNode = _skipDead(_findFirstNode(root));
+        NODE* rightNode = _skipDead(_findFirstNode(other.root));
+        while (leftNode && rightNode) {
             if (leftNode->priority != rightNode->priority || leftNode->value != rightNode->value) {
                 return false;
             }
+            leftNode = _skipDead(_successor(leftNode));
+            rightNode = _skipDead(_successor(rightNode));
+        }
+        return leftNode == rightNode;
+    }
 
-            // Recursively compare left and right subtrees.
-            return areEqual(leftNode->left, rightNode->left) && areEqual(leftNode->right, rightNode->right) && areEqual(leftNode->link, rightNode->link);
-        };
 
-        // Call the helper function to compare the root nodes of the BSTs.
-        return areEqual(root, other.root);
+    //
+    // fingerprint:
+    //
+    // Returns a hash of the queue contents that is maintained incrementally
+    // by every operation.  Two queues holding the same elements in the same
+    // priority and FIFO order have the same fingerprint, whatever order the
+    // different priorities were inserted in, so replicas can be compared
+    // without walking them.  Equal fingerprints mean "almost certainly
+    // equal"; use operator== to be sure.  Values are hashed with std::hash,
+    // so fingerprints are only comparable between builds that agree on it.
+    // O(1), plus compaction of any cancelled elements
+    //
+    size_t fingerprint() {
+        compact();
+        return _hsum(root);
+    }
+
+
+#ifdef PRQUEUE_STATS
+    //
+    // stats / reset_stats:
+    //
+    // Operation counters and latency histograms collected since
+    // construction or the last reset_stats().  Only available when compiled
+    // with PRQUEUE_STATS.
+    //
+    const prqueue_stats& stats() const {
+        return st;
+    }
+
+    void reset_stats() {
+        st = prqueue_stats();
     }
+#endif
 
 
     //
@@ -0,0 +1,42 @@
+/// @file prqueue_parallel.h
+///
+/// Parallel execution policies for prqueue's bulk operations.
+
+// Description: prqueue::assign and prqueue::for_each take a standard
+// execution policy, but prqueue.h itself runs every policy on the calling
+// thread so that it does not depend on <execution>, whose parallel
+// algorithms need a backend library (TBB with libstdc++, link -ltbb).
+// Including this header specializes prqueue_policy for execution::par
+// and execution::par_unseq: the copy, bulk build and traversal then fork
+// tasks for the top levels of the tree, and the bulk build sorts its
+// input with the parallel stable_sort.  Include it in every translation
+// unit that passes a parallel policy to a prqueue.
+
+#pragma once
+
+#include <algorithm>
+#include <execution>
+
+#include "prqueue.h"
+
+using namespace std;
+
+template<>
+struct prqueue_policy<execution::parallel_policy> {
+    static const bool forks = true;
+
+    template<typename RandomIt, typename Less>
+    static void stable_sort(RandomIt first, RandomIt last, Less less) {
+        std::stable_sort(execution::par, first, last, less);
+    }
+};
+
+template<>
+struct prqueue_policy<execution::parallel_unsequenced_policy> {
+    static const bool forks = true;
+
+    template<typename RandomIt, typename Less>
+    static void stable_sort(RandomIt first, RandomIt last, Less less) {
+        std::stable_sort(execution::par_unseq, first, last, less);
+    }
+};
@@ -0,0 +1,196 @@
+/// @file prstats.h
+///
+/// Operation counters and latency histograms for prqueue.
+
+// Description: prqueue only collects these when compiled with
+// -DPRQUEUE_STATS; without it none of the bookkeeping is compiled in.
+// latency_histogram is a log-linear (HDR-style) histogram: values are
+// bucketed by power of two and each power of two is split into 16 linear
+// sub-buckets, so every recorded latency is kept to within ~6% from a few
+// nanoseconds up to minutes with a fixed 1K-bucket table.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+using namespace std;
+
+class latency_histogram {
+private:
+    static const int SUB_BITS = 4;
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAGNITUDES = 64 - SUB_BITS;
+
+    uint64_t buckets[MAGNITUDES + 1][SUB];
+    uint64_t n;
+    uint64_t total;
+    uint64_t maxValue;
+
+    // Bucket of value v: magnitude 0 holds 0..SUB-1 exactly, magnitude k
+    // holds [SUB << (k-1), SUB << k) in SUB equal steps.
+    static void _index(uint64_t v, int& mag, int& sub) {
+        if (v < (uint64_t) SUB) {
+            mag = 0;
+            sub = (int) v;
+            return;
+        }
+        int top = 63 - __builtin_clzll(v);     // position of highest set bit
+        mag = top - SUB_BITS + 1;
+        sub = (int) ((v >> (top - SUB_BITS)) & (SUB - 1));
+    }
+
+    // Smallest value that falls in bucket (mag, sub).
+    static uint64_t _lowest(int mag, int sub) {
+        if (mag == 0) {
+            return (uint64_t) sub;
+        }
+        return ((uint64_t) (SUB + sub)) << (mag - 1);
+    }
+
+public:
+    latency_histogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        n = 0;
+        total = 0;
+        maxValue = 0;
+    }
+
+    void record(uint64_t v) {
+        int mag, sub;
+        _index(v, mag, sub);
+        buckets[mag][sub]++;
+        n++;
+        total += v;
+        if (v > maxValue) {
+            maxValue = v;
+        }
+    }
+
+    uint64_t count() const {
+        return n;
+    }
+
+    uint64_t max() const {
+        return maxValue;
+    }
+
+    double mean() const {
+        return n == 0 ? 0.0 : (double) total / (double) n;
+    }
+
+    //
+    // percentile:
+    //
+    // Returns the lower bound of the bucket holding the q-th percentile
+    // (0 <= q <= 100) of the recorded values.
+    //
+    uint64_t percentile(double q) const {
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t) (q / 100.0 * (double) n);
+        if (rank >= n) {
+            rank = n - 1;
+        }
+        uint64_t seen = 0;
+        for (int mag = 0; mag <= MAGNITUDES; mag++) {
+            for (int sub = 0; sub < SUB; sub++) {
+                seen += buckets[mag][sub];
+                if (seen > rank) {
+                    return _lowest(mag, sub);
+                }
+            }
+        }
+        return maxValue;
+    }
+
+    //
+    // timer:
+    //
+    // Records the nanoseconds between its construction and destruction.
+    //
+    class timer {
+    private:
+        latency_histogram& hist;
+        chrono::steady_clock::time_point start;
+
+    public:
+        explicit timer(latency_histogram& h)
+            : hist(h), start(chrono::steady_clock::now()) {}
+
+        ~timer() {
+            hist.record((uint64_t) chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count());
+        }
+    };
+};
+
+
+//
+// prqueue_stats:
+//
+// Counters collected by a prqueue built with PRQUEUE_STATS.  A "descent"
+// is the number of nodes visited while walking the tree (or a duplicate
+// chain) to find the insert position or the minimum.
+//
+struct prqueue_stats {
+    static const int MAX_DEPTH = 64;
+
+    uint64_t enqueues = 0;
+    uint64_t dequeues = 0;
+    uint64_t peeks = 0;
+    uint64_t depthHistogram[MAX_DEPTH] = {};  // insert depth; last bucket is 63+
+    uint64_t descentNodes = 0;                // nodes visited by all descents
+    uint64_t descents = 0;                    // # of descents measured
+    uint64_t longestChain = 0;                // longest duplicate chain built
+    uint64_t allocHits = 0;                   // nodes reused from a free list
+    uint64_t allocMisses = 0;                 // nodes taken from the heap
+    latency_histogram enqueueLatency;
+    latency_histogram dequeueLatency;
+    latency_histogram peekLatency;
+
+    double averageDescent() const {
+        return descents == 0 ? 0.0 : (double) descentNodes / (double) descents;
+    }
+
+    void recordDepth(uint64_t depth) {
+        depthHistogram[depth < (uint64_t) MAX_DEPTH ? depth : MAX_DEPTH - 1]++;
+    }
+
+    //
+    // print:
+    //
+    // Writes a human-readable dump of every counter to out.
+    //
+    void print(ostream& out) const {
+        out << "enqueues " << enqueues << ", dequeues " << dequeues
+            << ", peeks " << peeks << "\n";
+        out << "average descent " << fixed << setprecision(2) << averageDescent()
+            << " nodes, longest duplicate chain " << longestChain << "\n";
+        out << "allocator hits " << allocHits << ", misses " << allocMisses << "\n";
+        out << "insert depth histogram:";
+        for (int d = 0; d < MAX_DEPTH; d++) {
+            if (depthHistogram[d] != 0) {
+                out << " " << d << ":" << depthHistogram[d];
+            }
+        }
+        out << "\n";
+        _printLatency(out, "enqueue", enqueueLatency);
+        _printLatency(out, "dequeue", dequeueLatency);
+        _printLatency(out, "peek", peekLatency);
+    }
+
+    static void _printLatency(ostream& out, const char* name, const latency_histogram& h) {
+        out << name << " latency ns: mean " << fixed << setprecision(1) << h.mean()
+            << " p50 " << h.percentile(50) << " p99 " << h.percentile(99)
+            << " p99.9 " << h.percentile(99.9) << " max " << h.max() << "\n";
+    }
+};
@@ -0,0 +1,258 @@
+/// @file rcuqueue.h
+///
+/// Priority queue whose readers traverse a consistent version without
+/// locks while writers keep mutating it (read-copy-update).
+
+// Description: rcu_prqueue keeps its contents as a persistent_prqueue
+// version behind an atomic pointer.  A writer takes the writer mutex,
+// builds the next version from the current one (path copying, so the
+// current version is never touched) and publishes it with a release
+// store.  A reader enters a read section (read_guard), loads the pointer
+// with acquire and may then peek, for_each or toString that version for as
+// long as the guard lives, without a lock and without touching any
+// reference count; writers never wait for readers.
+//
+// Superseded versions are reclaimed with epoch-based reclamation.  A read
+// section records the global epoch in a reader slot; a writer retires the
+// version it replaced under the current epoch and advances the epoch.  A
+// retired version is freed once no reader slot holds an epoch at or before
+// the one it was retired in, because every reader that entered later
+// loaded a newer pointer.  A reader that stays inside its section delays
+// reclamation of the versions retired meanwhile, never the writers.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "persistentqueue.h"
+
+using namespace std;
+
+template<typename T>
+class rcu_prqueue {
+public:
+    static const int MAX_READERS = 64;  // concurrent read sections
+
+private:
+    typedef persistent_prqueue<T> VERSION;
+
+    // Epoch of one read section, 0 when the slot is idle.  Padded to a
+    // cache line so readers entering and leaving do not share lines.
+    struct alignas(64) SLOT {
+        atomic<uint64_t> epoch{0};
+        atomic<bool> busy{false};
+    };
+
+    atomic<const VERSION*> current;
+    atomic<uint64_t> globalEpoch;
+    SLOT slots[MAX_READERS];
+
+    mutex writeLock;                                 // serializes writers; guards retired
+    vector<pair<uint64_t, const VERSION*>> retired;  // (epoch retired in, version)
+
+    // Claims an idle reader slot and publishes the epoch of the read
+    // section in it.  Spins only when MAX_READERS sections are open.
+    SLOT* _enter() {
+        size_t start = hash<thread::id>()(this_thread::get_id());
+        for (size_t i = 0;; i++) {
+            SLOT& slot = slots[(start + i) % MAX_READERS];
+            bool idle = false;
+            if (!slot.busy.load(memory_order_relaxed) &&
+                slot.busy.compare_exchange_strong(idle, true, memory_order_acquire)) {
+                slot.epoch.store(globalEpoch.load(), memory_order_relaxed);
+                // Orders the slot store before the version load; pairs with
+                // the fence in _retire.
+                atomic_thread_fence(memory_order_seq_cst);
+                return &slot;
+            }
+            if (i % MAX_READERS == MAX_READERS - 1) {
+                this_thread::yield();
+            }
+        }
+    }
+
+    static void _leave(SLOT* slot) {
+        slot->epoch.store(0, memory_order_release);
+        slot->busy.store(false, memory_order_release);
+    }
+
+    // Publishes next and retires the version it replaces.  Caller holds
+    // writeLock.
+    void _publish(const VERSION* next) {
+        const VERSION* old = current.load(memory_order_relaxed);
+        current.store(next, memory_order_release);
+        retired.push_back({globalEpoch.fetch_add(1), old});
+        // Orders the publication before the slot scan; pairs with the
+        // fence in _enter.
+        atomic_thread_fence(memory_order_seq_cst);
+        _reclaim();
+    }
+
+    // Frees the retired versions that no read section can still see.
+    // Caller holds writeLock.
+    void _reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (SLOT& slot : slots) {
+            uint64_t e = slot.epoch.load(memory_order_acquire);
+            if (e != 0 && e < oldest) {
+                oldest = e;
+            }
+        }
+        size_t kept = 0;
+        for (auto& [epoch, version] : retired) {
+            if (epoch < oldest) {
+                delete version;
+            } else {
+                retired[kept++] = {epoch, version};
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    //
+    // read_guard:
+    //
+    // A read section.  While it lives, *guard is one consistent version of
+    // the queue that no writer will change or free.  Guards are meant to
+    // be short-lived and are not shared between threads.
+    //
+    class read_guard {
+    private:
+        SLOT* slot;
+        const VERSION* version;
+
+        friend class rcu_prqueue;
+
+        read_guard(SLOT* s, const VERSION* v) : slot(s), version(v) {}
+
+    public:
+        read_guard(const read_guard&) = delete;
+        read_guard& operator=(const read_guard&) = delete;
+
+        ~read_guard() {
+            _leave(slot);
+        }
+
+        const VERSION& operator*() const {
+            return *version;
+        }
+
+        const VERSION* operator->() const {
+            return version;
+        }
+    };
+
+    rcu_prqueue() : current(new VERSION()), globalEpoch(1) {}
+
+    rcu_prqueue(const rcu_prqueue&) = delete;
+    rcu_prqueue& operator=(const rcu_prqueue&) = delete;
+
+    // No read section may be open.
+    ~rcu_prqueue() {
+        for (auto& [epoch, version] : retired) {
+            delete version;
+        }
+        delete current.load();
+    }
+
+
+    //
+    // read:
+    //
+    // Opens a read section on the current version.  Lock-free: it neither
+    // waits for writers nor makes them wait.
+    // O(1)
+    //
+    read_guard read() {
+        SLOT* slot = _enter();
+        return read_guard(slot, current.load(memory_order_acquire));
+    }
+
+
+    //
+    // snapshot:
+    //
+    // The current version, kept alive by reference counting rather than
+    // by a read section, for readers that need it beyond a short scope.
+    // O(1)
+    //
+    VERSION snapshot() {
+        return *read();
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value behind any elements of the same priority and
+    // publishes the new version.
+    // O(logn) expected, plus O(r) to reclaim with r open read sections
+    //
+    void enqueue(T value, int priority) {
+        lock_guard<mutex> guard(writeLock);
+        const VERSION* version = current.load(memory_order_relaxed);
+        _publish(new VERSION(version->enqueue(move(value), priority)));
+    }
+
+
+    //
+    // dequeue / try_dequeue:
+    //
+    // Remove the next element and publish the new version.  dequeue
+    // returns T{} and try_dequeue an empty optional when the queue is
+    // empty.
+    // O(logn) expected, plus O(r) to reclaim
+    //
+    T dequeue() {
+        optional<T> value = try_dequeue();
+        return value ? move(*value) : T{};
+    }
+
+    optional<T> try_dequeue() {
+        lock_guard<mutex> guard(writeLock);
+        const VERSION* version = current.load(memory_order_relaxed);
+        const T* next = version->peek_ref();
+        if (next == nullptr) {
+            return nullopt;
+        }
+        optional<T> value(*next);
+        _publish(new VERSION(version->dequeue()));
+        return value;
+    }
+
+
+    //
+    // size / toString:
+    //
+    // Of the current version, read in a read section.
+    // O(1) / O(n)
+    //
+    int size() {
+        return read()->size();
+    }
+
+    string toString() {
+        return read()->toString();
+    }
+
+
+    //
+    // retired_count:
+    //
+    // Versions replaced by writers but not yet freed because a read
+    // section may still see them.
+    // O(1)
+    //
+    int retired_count() {
+        lock_guard<mutex> guard(writeLock);
+        return (int) retired.size();
+    }
+};
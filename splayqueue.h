@@ -0,0 +1,281 @@
+/// @file splayqueue.h
+///
+/// Self-adjusting (top-down splay tree) priority queue with prqueue's FIFO
+/// duplicate semantics.
+
+// Description: splay_prqueue keeps one tree node per distinct priority,
+// like prqueue, with equal priorities chained behind it in FIFO order.
+// Every enqueue and dequeue splays the priority it touches to the root
+// (Sleator and Tarjan's top-down splay), so the minimum and the priorities
+// just above it, which is where dequeue and clustered enqueues keep
+// working, stay within a few links of the root.  Operations are
+// O(logn) amortized, with no rebalancing metadata per node; a run of
+// dequeues walks the left spine once and then takes O(1) amortized each.
+
+#pragma once
+
+#include <climits>
+#include <optional>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+template<typename T>
+class splay_prqueue {
+private:
+    struct NODE;
+    struct LINKS {
+        NODE* left;    // children (chain heads only)
+        NODE* right;
+    };
+    struct NODE : LINKS {
+        int priority;
+        T value;
+        NODE* link;    // next element with the same priority
+        NODE* tail;    // last node of the duplicate chain (chain heads only)
+    };
+    NODE* root; // chain head of some priority; the last one splayed
+    int sz;     // # of elements
+
+    // Top-down splay: makes the node with priority key the root, or the
+    // last node on the search path if there is none.
+    static NODE* _splay(NODE* t, int key) {
+        if (t == nullptr) {
+            return nullptr;
+        }
+        // The header only needs links, so no T is constructed per splay.
+        LINKS header;
+        header.left = header.right = nullptr;
+        LINKS* l = &header;  // max of the left tree built so far
+        LINKS* r = &header;  // min of the right tree built so far
+
+        for (;;) {
+            if (key < t->priority) {
+                if (t->left == nullptr) {
+                    break;
+                }
+                if (key < t->left->priority) {
+                    NODE* y = t->left;          // rotate right
+                    t->left = y->right;
+                    y->right = t;
+                    t = y;
+                    if (t->left == nullptr) {
+                        break;
+                    }
+                }
+                r->left = t;                    // link right
+                r = t;
+                t = t->left;
+            } else if (key > t->priority) {
+                if (t->right == nullptr) {
+                    break;
+                }
+                if (key > t->right->priority) {
+                    NODE* y = t->right;         // rotate left
+                    t->right = y->left;
+                    y->left = t;
+                    t = y;
+                    if (t->right == nullptr) {
+                        break;
+                    }
+                }
+                l->right = t;                   // link left
+                l = t;
+                t = t->right;
+            } else {
+                break;
+            }
+        }
+        l->right = t->left;                     // assemble
+        r->left = t->right;
+        t->left = header.right;
+        t->right = header.left;
+        return t;
+    }
+
+    // Frees a subtree without recursion (a splay tree can be a path of
+    // length n): left children are rotated up until there are none.
+    static void _freeTree(NODE* node) {
+        while (node != nullptr) {
+            if (node->left != nullptr) {
+                NODE* y = node->left;
+                node->left = y->right;
+                y->right = node;
+                node = y;
+                continue;
+            }
+            NODE* right = node->right;
+            while (node != nullptr) {
+                NODE* next = node->link;
+                delete node;
+                node = next;
+            }
+            node = right;
+        }
+    }
+
+public:
+    splay_prqueue() {
+        root = nullptr;
+        sz = 0;
+    }
+
+    splay_prqueue(const splay_prqueue&) = delete;
+    splay_prqueue& operator=(const splay_prqueue&) = delete;
+
+    ~splay_prqueue() {
+        clear();
+    }
+
+
+    //
+    // clear:
+    //
+    // Removes and frees every element.
+    // O(n)
+    //
+    void clear() {
+        _freeTree(root);
+        root = nullptr;
+        sz = 0;
+    }
+
+
+    //
+    // enqueue:
+    //
+    // Inserts the value behind any elements of the same priority.  The
+    // priority's node ends up at the root.
+    // O(logn) amortized
+    //
+    void enqueue(T value, int priority) {
+        NODE* node = new NODE{{nullptr, nullptr}, priority, move(value), nullptr, nullptr};
+        node->tail = node;
+        sz++;
+
+        if (root == nullptr) {
+            root = node;
+            return;
+        }
+        root = _splay(root, priority);
+        if (priority == root->priority) {
+            root->tail->link = node;
+            root->tail = node;
+        } else if (priority < root->priority) {
+            node->left = root->left;
+            node->right = root;
+            root->left = nullptr;
+            root = node;
+        } else {
+            node->right = root->right;
+            node->left = root;
+            root->right = nullptr;
+            root = node;
+        }
+    }
+
+
+    //
+    // dequeue / try_dequeue:
+    //
+    // Removes the next element (lowest priority number, FIFO among equal
+    // priorities).  dequeue returns T{} and try_dequeue an empty optional
+    // when the queue is empty.
+    // O(logn) amortized
+    //
+    T dequeue() {
+        optional<T> value = try_dequeue();
+        return value ? move(*value) : T{};
+    }
+
+    optional<T> try_dequeue() {
+        if (root == nullptr) {
+            return nullopt;
+        }
+        root = _splay(root, INT_MIN);   // the minimum has no left child now
+        NODE* node = root;
+        optional<T> value(move(node->value));
+        if (node->link != nullptr) {
+            NODE* next = node->link;
+            next->right = node->right;
+            next->left = nullptr;
+            next->tail = node->tail;
+            root = next;
+        } else {
+            root = node->right;
+        }
+        delete node;
+        sz--;
+        return value;
+    }
+
+
+    //
+    // peek / peek_ref / peek_priority:
+    //
+    // Look at the next element without removing it; peek_ref returns
+    // nullptr and peek_priority false when the queue is empty.  The
+    // minimum is splayed to the root, so a following dequeue is O(1).
+    // O(logn) amortized
+    //
+    T peek() {
+        const T* value = peek_ref();
+        return value ? *value : T{};
+    }
+
+    const T* peek_ref() {
+        if (root == nullptr) {
+            return nullptr;
+        }
+        root = _splay(root, INT_MIN);
+        return &root->value;
+    }
+
+    bool peek_priority(int& priority) {
+        if (root == nullptr) {
+            return false;
+        }
+        root = _splay(root, INT_MIN);
+        priority = root->priority;
+        return true;
+    }
+
+
+    //
+    // size:
+    //
+    // O(1)
+    //
+    int size() const {
+        return sz;
+    }
+
+
+    //
+    // toString:
+    //
+    // Same format as prqueue::toString.
+    // O(n)
+    //
+    string toString() {
+        stringstream ss;
+        stack<NODE*> pending;
+        NODE* node = root;
+        while (node != nullptr || !pending.empty()) {
+            while (node != nullptr) {
+                pending.push(node);
+                node = node->left;
+            }
+            node = pending.top();
+            pending.pop();
+            for (NODE* dup = node; dup != nullptr; dup = dup->link) {
+                ss << dup->priority << " value: " << dup->value << "\n";
+            }
+            node = node->right;
+        }
+        return ss.str();
+    }
+};
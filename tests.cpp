@@ -10,8 +10,28 @@
 #define CATCH_CONFIG_MAIN
 
 #include "prqueue.h"
+#include "agingqueue.h"
+#include "arena.h"
+#include "asyncqueue.h"
+#include "blockingqueue.h"
+#include "inlinetask.h"
+#include "multiqueue.h"
+#include "numaqueue.h"
+#include "pairingheap.h"
+#include "persistentqueue.h"
+#include "prqueue_parallel.h"
+#include "rcuqueue.h"
+#include "splayqueue.h"
+#include "timerwheel.h"
+#include "workstealing.h"
 #include "catch.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <thread>
+#include <vector>
+
 using namespace std;
 
 TEST_CASE("Test enqueue() function") {
@@ -570,5 +590,1836 @@ TEST_CASE("Test equality operator (operator==)") {
     }
 }
 
+TEST_CASE("Test multiqueue") {
+    SECTION("Test multiqueue returns every element once") {
+        multiqueue<int> mq(4);
+        for (int i = 0; i < 1000; i++) {
+            mq.enqueue(i, (i * 7919) % 1000);
+        }
+        REQUIRE(mq.size() == 1000);
+
+        vector<int> seen;
+        int value, priority;
+        while (mq.dequeue(value, priority)) {
+            REQUIRE(priority == (value * 7919) % 1000);
+            seen.push_back(value);
+        }
+        REQUIRE(mq.size() == 0);
+        sort(seen.begin(), seen.end());
+        for (int i = 0; i < 1000; i++) {
+            REQUIRE(seen[i] == i);
+        }
+    }
+
+    SECTION("Test multiqueue rank error statistics") {
+        multiqueue<int> mq(2, 2);
+        mq.track_rank_error(true);
+        for (int i = 0; i < 200; i++) {
+            mq.enqueue(i, i);
+        }
+        int value, priority;
+        while (mq.dequeue(value, priority)) {
+        }
+        auto stats = mq.rank_error();
+        REQUIRE(stats.samples == 200);
+        REQUIRE(stats.max < mq.shard_count());
+        REQUIRE(stats.mean() <= (double) stats.max);
+    }
+
+    SECTION("Test multiqueue moves move-only values") {
+        multiqueue<unique_ptr<int>> mq(2);
+        mq.enqueue(make_unique<int>(7), 7);
+        mq.enqueue(make_unique<int>(3), 3);
+        unique_ptr<int> value;
+        int priority;
+        REQUIRE(mq.dequeue(value, priority));
+        REQUIRE(value != nullptr);
+        REQUIRE(priority == *value);
+        REQUIRE(mq.dequeue(value, priority));
+        REQUIRE(priority == *value);
+        REQUIRE_FALSE(mq.dequeue(value, priority));
+    }
+
+    SECTION("Test multiqueue with concurrent producers and consumers") {
+        multiqueue<int> mq(4);
+        atomic<long> consumed(0);
+        atomic<long> sum(0);
+        vector<thread> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&, t]() {
+                for (int i = 0; i < 2000; i++) {
+                    mq.enqueue(t * 2000 + i, i);
+                    int value, priority;
+                    if (i % 2 == 1 && mq.dequeue(value, priority)) {
+                        consumed++;
+                        sum += value;
+                    }
+                }
+            });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        int value, priority;
+        while (mq.dequeue(value, priority)) {
+            consumed++;
+            sum += value;
+        }
+        REQUIRE(consumed == 8000);
+        REQUIRE(sum == 8000L * 7999 / 2);
+    }
+}
+
+TEST_CASE("Test split_half() function") {
+    SECTION("Test split_half() on an empty priority queue") {
+        prqueue<int> pq;
+        prqueue<int> part = pq.split_half();
+        REQUIRE(part.size() == 0);
+        REQUIRE(pq.size() == 0);
+    }
+
+    SECTION("Test split_half() keeps a duplicate chain together") {
+        prqueue<int> pq;
+        pq.enqueue(50, 5);
+        pq.enqueue(20, 2);
+        pq.enqueue(80, 8);
+        pq.enqueue(10, 1);
+        pq.enqueue(30, 3);
+        pq.enqueue(31, 3);
+
+        prqueue<int> part = pq.split_half();
+        REQUIRE(part.size() == 4);
+        REQUIRE(pq.size() == 2);
+        REQUIRE(part.toString() == "1 value: 10\n2 value: 20\n3 value: 30\n3 value: 31\n");
+        REQUIRE(pq.toString() == "5 value: 50\n8 value: 80\n");
+    }
+
+    SECTION("Test split_half() when the root is the minimum") {
+        prqueue<int> pq;
+        pq.enqueue(10, 1);
+        pq.enqueue(11, 1);
+        pq.enqueue(20, 2);
+
+        prqueue<int> part = pq.split_half();
+        REQUIRE(part.size() == 2);
+        REQUIRE(part.dequeue() == 10);
+        REQUIRE(part.dequeue() == 11);
+        REQUIRE(pq.size() == 1);
+        REQUIRE(pq.dequeue() == 20);
+    }
+
+    SECTION("Test split_half() halves a queue filled in ascending order") {
+        prqueue<int> pq;
+        for (int i = 0; i < 1001; i++) {
+            pq.enqueue(i, i);
+        }
+
+        prqueue<int> part = pq.split_half();
+        REQUIRE(part.size() == 501);
+        REQUIRE(pq.size() == 500);
+        REQUIRE(part.peek() == 0);
+        REQUIRE(part.peek_max() == 500);
+        REQUIRE(pq.peek() == 501);
+        REQUIRE(pq.peek_max() == 1000);
+        REQUIRE(part.count_range(INT_MIN, INT_MAX) == 501);
+        REQUIRE(pq.count_range(INT_MIN, INT_MAX) == 500);
+
+        prqueue<int> quarter = pq.split_half();
+        REQUIRE(quarter.size() == 250);
+        REQUIRE(pq.size() == 250);
+        REQUIRE(pq.dequeue() == 751);
+    }
+}
+
+TEST_CASE("Test ws_scheduler") {
+    SECTION("Test ws_scheduler runs a fork-join tree") {
+        atomic<int> leaves(0);
+        ws_scheduler sched(4);
+        function<void(int)> fork = [&](int depth) {
+            if (depth == 0) {
+                leaves++;
+                return;
+            }
+            sched.spawn([&, depth]() { fork(depth - 1); }, depth);
+            sched.spawn([&, depth]() { fork(depth - 1); }, depth);
+        };
+        sched.spawn([&]() { fork(10); });
+        sched.wait();
+        REQUIRE(leaves == 1024);
+    }
+}
+
+TEST_CASE("Test blocking_prqueue") {
+    SECTION("Test try_dequeue() and wait_dequeue_for() on an empty queue") {
+        blocking_prqueue<int> bq;
+        int value = -1;
+        REQUIRE_FALSE(bq.try_dequeue(value));
+        REQUIRE_FALSE(bq.wait_dequeue_for(value, chrono::milliseconds(5)));
+        REQUIRE(value == -1);
+    }
+
+    SECTION("Test dequeue order and default values") {
+        blocking_prqueue<int> bq;
+        bq.enqueue(0, 2);
+        bq.enqueue(7, 1);
+        int value = -1;
+        REQUIRE(bq.try_dequeue(value));
+        REQUIRE(value == 7);
+        REQUIRE(bq.wait_dequeue_for(value, chrono::milliseconds(5)));
+        REQUIRE(value == 0); // a real element, not the empty marker
+        REQUIRE(bq.size() == 0);
+    }
+
+    SECTION("Test blocked consumers are woken by producers") {
+        blocking_prqueue<int> bq;
+        atomic<long> sum(0);
+        vector<thread> consumers;
+        for (int t = 0; t < 3; t++) {
+            consumers.emplace_back([&]() {
+                for (int i = 0; i < 100; i++) {
+                    sum += bq.wait_dequeue();
+                }
+            });
+        }
+        vector<pair<int, int>> burst;
+        for (int i = 0; i < 150; i++) {
+            burst.push_back({i, i % 7});
+        }
+        bq.enqueue_bulk(burst.begin(), burst.end());
+        for (int i = 150; i < 300; i++) {
+            bq.enqueue(i, i % 5);
+        }
+        for (auto& c : consumers) {
+            c.join();
+        }
+        REQUIRE(sum == 300L * 299 / 2);
+        REQUIRE(bq.size() == 0);
+    }
+}
+
+TEST_CASE("Test dequeue_ready() function") {
+    SECTION("Test dequeue_ready() on an empty priority queue") {
+        prqueue<int> pq;
+        vector<int> out;
+        pq.dequeue_ready(10, back_inserter(out));
+        REQUIRE(out.empty());
+    }
+
+    SECTION("Test dequeue_ready() with mixed priorities") {
+        prqueue<int> pq;
+        pq.enqueue(50, 5);
+        pq.enqueue(20, 2);
+        pq.enqueue(80, 8);
+        pq.enqueue(40, 4);
+        pq.enqueue(41, 4);
+        pq.enqueue(60, 6);
+        pq.enqueue(10, 1);
+        pq.enqueue(70, 7);
+
+        vector<int> out;
+        pq.dequeue_ready(5, back_inserter(out));
+        REQUIRE(out == vector<int>{10, 20, 40, 41, 50});
+        REQUIRE(pq.size() == 3);
+        REQUIRE(pq.toString() == "6 value: 60\n7 value: 70\n8 value: 80\n");
+
+        out.clear();
+        pq.dequeue_ready(0, back_inserter(out));
+        REQUIRE(out.empty());
+
+        pq.dequeue_ready(100, back_inserter(out));
+        REQUIRE(out == vector<int>{60, 70, 80});
+        REQUIRE(pq.size() == 0);
+    }
+
+    SECTION("Test dequeue_ready() moves values out") {
+        prqueue<unique_ptr<int>> pq;
+        pq.enqueue(make_unique<int>(2), 2);
+        pq.enqueue(make_unique<int>(1), 1);
+        pq.enqueue(make_unique<int>(3), 3);
+
+        vector<unique_ptr<int>> out;
+        pq.dequeue_ready(2, back_inserter(out));
+        REQUIRE(out.size() == 2);
+        REQUIRE(*out[0] == 1);
+        REQUIRE(*out[1] == 2);
+        REQUIRE(pq.size() == 1);
+    }
+}
+
+TEST_CASE("Test timer_wheel") {
+    SECTION("Test timer_wheel fires items in due order") {
+        timer_wheel<int> tw;
+        vector<pair<int, int>> expected; // due, value
+        vector<int> fired;
+        unsigned seed = 12345;
+        int id = 0;
+        for (int round = 0; round < 40; round++) {
+            for (int i = 0; i < 50; i++) {
+                seed = seed * 1103515245 + 12345;
+                int range = (i % 3 == 0) ? 100 : (i % 3 == 1) ? 20000 : 1000000;
+                int due = tw.now() + 1 + (int) ((seed >> 8) % range);
+                tw.schedule(id, due);
+                expected.push_back({due, id});
+                id++;
+            }
+            tw.advance(tw.now() + 30000, back_inserter(fired));
+        }
+        tw.advance(tw.now() + 2000000, back_inserter(fired));
+        REQUIRE(tw.size() == 0);
+
+        stable_sort(expected.begin(), expected.end(),
+            [](const pair<int, int>& a, const pair<int, int>& b) { return a.first < b.first; });
+        REQUIRE(fired.size() == expected.size());
+        for (size_t i = 0; i < fired.size(); i++) {
+            REQUIRE(fired[i] == expected[i].second);
+        }
+    }
+
+    SECTION("Test timer_wheel fires overdue items on the next advance") {
+        timer_wheel<string> tw(100);
+        tw.schedule("late", 50);
+        tw.schedule("soon", 101);
+        vector<string> fired;
+        tw.advance(100, back_inserter(fired));
+        REQUIRE(fired == vector<string>{"late"});
+        tw.advance(101, back_inserter(fired));
+        REQUIRE(fired == vector<string>{"late", "soon"});
+    }
+
+    SECTION("Test timer_wheel with move-only values beyond the horizon") {
+        timer_wheel<unique_ptr<int>> tw(0);
+        tw.schedule(make_unique<int>(2), 1 << 20);
+        tw.schedule(make_unique<int>(1), 5);
+        vector<unique_ptr<int>> fired;
+        tw.advance(1 << 20, back_inserter(fired));
+        REQUIRE(fired.size() == 2);
+        REQUIRE(*fired[0] == 1);
+        REQUIRE(*fired[1] == 2);
+    }
+
+    SECTION("Test timer_wheel fires overdue items in due order") {
+        timer_wheel<string> tw(100);
+        tw.schedule("a", 50);
+        tw.schedule("b", 10);
+        tw.schedule("c", 50);
+        tw.schedule("d", 100);
+        vector<string> fired;
+        tw.advance(100, back_inserter(fired));
+        REQUIRE(fired == vector<string>{"b", "a", "c", "d"});
+    }
+}
+
+#ifdef PRQUEUE_STATS
+TEST_CASE("Test stats() function") {
+    SECTION("Test stats() counts operations and chains") {
+        prqueue<int> pq;
+        pq.enqueue(10, 2);
+        pq.enqueue(20, 1);
+        pq.enqueue(30, 3);
+        pq.enqueue(31, 3);
+        pq.enqueue(32, 3);
+        pq.peek();
+        pq.dequeue();
+
+        const prqueue_stats& st = pq.stats();
+        REQUIRE(st.enqueues == 5);
+        REQUIRE(st.dequeues == 1);
+        REQUIRE(st.peeks == 1);
+        REQUIRE(st.longestChain == 3);
+        REQUIRE(st.allocMisses == 5);
+        REQUIRE(st.depthHistogram[0] == 1);
+        REQUIRE(st.depthHistogram[1] == 4);
+        REQUIRE(st.enqueueLatency.count() == 5);
+        REQUIRE(st.dequeueLatency.count() == 1);
+
+        pq.reset_stats();
+        REQUIRE(pq.stats().enqueues == 0);
+    }
+
+    SECTION("Test latency_histogram percentiles") {
+        latency_histogram h;
+        for (uint64_t v = 1; v <= 1000; v++) {
+            h.record(v);
+        }
+        REQUIRE(h.count() == 1000);
+        REQUIRE(h.max() == 1000);
+        REQUIRE(h.percentile(50) >= 470);
+        REQUIRE(h.percentile(50) <= 500);
+        REQUIRE(h.percentile(100) <= 1000);
+    }
+}
+#endif
+
+TEST_CASE("Test operator== compares contents, not shape") {
+    SECTION("Test operator== on the same sequence built in different orders") {
+        prqueue<int> pq1;
+        prqueue<int> pq2;
+        for (int i = 0; i < 50; i++) {
+            pq1.enqueue(i, i % 10);
+        }
+        for (int p = 9; p >= 0; p--) {
+            for (int i = p; i < 50; i += 10) {
+                pq2.enqueue(i, p);
+            }
+        }
+        REQUIRE(pq1 == pq2);
+        pq1.dequeue();
+        pq2.dequeue();
+        REQUIRE(pq1 == pq2);
+    }
+
+    SECTION("Test operator== is sensitive to FIFO order of duplicates") {
+        prqueue<string> pq1;
+        pq1.enqueue("Apple", 2);
+        pq1.enqueue("Banana", 2);
+        prqueue<string> pq2;
+        pq2.enqueue("Banana", 2);
+        pq2.enqueue("Apple", 2);
+        REQUIRE_FALSE(pq1 == pq2);
+    }
+
+    SECTION("Test operator== on a type without std::hash") {
+        struct POINT {
+            int x;
+            bool operator!=(const POINT& other) const { return x != other.x; }
+        };
+        prqueue<POINT> pq1;
+        prqueue<POINT> pq2;
+        pq1.enqueue(POINT{1}, 1);
+        pq2.enqueue(POINT{1}, 1);
+        REQUIRE(pq1 == pq2);
+        pq2.enqueue(POINT{2}, 2);
+        pq1.enqueue(POINT{3}, 2);
+        REQUIRE_FALSE(pq1 == pq2);
+    }
+
+    SECTION("Test operator== after copy and split") {
+        prqueue<int> pq1;
+        for (int i = 0; i < 20; i++) {
+            pq1.enqueue(i, (i * 7) % 13);
+        }
+        prqueue<int> pq2(pq1);
+        REQUIRE(pq1 == pq2);
+        prqueue<int> part = pq2.split_half();
+        REQUIRE_FALSE(pq1 == pq2);
+        int priority;
+        while (part.peek_priority(priority)) {
+            pq2.enqueue(part.dequeue(), priority);
+        }
+        REQUIRE(pq2.size() == 20);
+    }
+}
+
+TEST_CASE("Test fingerprint() function") {
+    SECTION("Test fingerprint() of empty priority queues") {
+        prqueue<int> pq1;
+        prqueue<int> pq2;
+        REQUIRE(pq1.fingerprint() == pq2.fingerprint());
+        pq1.enqueue(1, 1);
+        pq1.dequeue();
+        REQUIRE(pq1.fingerprint() == pq2.fingerprint());
+    }
+
+    SECTION("Test fingerprint() ignores the order of different priorities") {
+        prqueue<string> pq1;
+        pq1.enqueue("Apple", 2);
+        pq1.enqueue("Banana", 1);
+        pq1.enqueue("Cherry", 2);
+        prqueue<string> pq2;
+        pq2.enqueue("Banana", 1);
+        pq2.enqueue("Apple", 2);
+        pq2.enqueue("Cherry", 2);
+        REQUIRE(pq1.fingerprint() == pq2.fingerprint());
+    }
+
+    SECTION("Test fingerprint() follows FIFO order within a priority") {
+        prqueue<string> pq1;
+        pq1.enqueue("Apple", 2);
+        pq1.enqueue("Banana", 2);
+        prqueue<string> pq2;
+        pq2.enqueue("Banana", 2);
+        pq2.enqueue("Apple", 2);
+        REQUIRE(pq1.fingerprint() != pq2.fingerprint());
+
+        // Replicas that diverge and then apply the same operations converge.
+        pq1.dequeue();
+        pq2.dequeue();
+        pq2.dequeue();
+        pq2.enqueue("Banana", 2);
+        REQUIRE(pq1.fingerprint() == pq2.fingerprint());
+        REQUIRE(pq1 == pq2);
+    }
+
+    SECTION("Test fingerprint() is maintained by every operation") {
+        prqueue<int> pq1;
+        prqueue<int> pq2;
+        for (int i = 0; i < 100; i++) {
+            pq1.enqueue(i, (i * 37) % 17);
+        }
+        vector<int> out;
+        pq1.dequeue_ready(5, back_inserter(out));
+        prqueue<int> part = pq1.split_half();
+        pq1.dequeue();
+
+        // Rebuild the same contents from scratch in priority order.
+        prqueue<int> copy(pq1);
+        int value, priority;
+        pq1.begin();
+        while (pq1.next(value, priority)) {
+            pq2.enqueue(value, priority);
+        }
+        REQUIRE(pq1.fingerprint() == pq2.fingerprint());
+        REQUIRE(copy.fingerprint() == pq1.fingerprint());
+    }
+}
+
+TEST_CASE("Test parallel assign() and for_each() functions") {
+    vector<pair<int, int>> items;
+    prqueue<int> expected;
+    for (int i = 0; i < 5000; i++) {
+        int priority = (i * 7919) % 1237;
+        items.push_back({i, priority});
+        expected.enqueue(i, priority);
+    }
+
+    SECTION("Test assign() bulk build with sequential and parallel policies") {
+        prqueue<int> seqBuilt;
+        prqueue<int> parBuilt;
+        seqBuilt.assign(execution::seq, items.begin(), items.end());
+        parBuilt.assign(execution::par, items.begin(), items.end());
+        REQUIRE(seqBuilt.size() == 5000);
+        REQUIRE(seqBuilt == expected);
+        REQUIRE(parBuilt == expected);
+        REQUIRE(parBuilt.fingerprint() == expected.fingerprint());
+        REQUIRE(parBuilt.toString() == expected.toString());
+    }
+
+    SECTION("Test assign() copy keeps contents and shape") {
+        prqueue<int> copy;
+        copy.enqueue(1, 1);
+        copy.assign(execution::par, expected);
+        REQUIRE(copy == expected);
+        REQUIRE(copy.fingerprint() == expected.fingerprint());
+
+        prqueue<int> assigned;
+        assigned = expected;
+        REQUIRE(assigned.toString() == expected.toString());
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(assigned.dequeue() == expected.dequeue());
+        }
+    }
+
+    SECTION("Test for_each() visits every element") {
+        vector<int> order;
+        expected.for_each(execution::seq, [&](const int& value, int priority) {
+            (void) priority;
+            order.push_back(value);
+        });
+        vector<int> inorder;
+        int value, priority;
+        expected.begin();
+        while (expected.next(value, priority)) {
+            inorder.push_back(value);
+        }
+        REQUIRE(order == inorder);
+
+        atomic<long> sum(0);
+        atomic<int> count(0);
+        expected.for_each(execution::par, [&](const int& value, int priority) {
+            (void) priority;
+            sum += value;
+            count++;
+        });
+        REQUIRE(count == 5000);
+        REQUIRE(sum == 5000L * 4999 / 2);
+    }
+}
+
+TEST_CASE("Test range queries") {
+    prqueue<int> pq;
+    pq.enqueue(50, 5);
+    pq.enqueue(20, 2);
+    pq.enqueue(80, 8);
+    pq.enqueue(21, 2);
+    pq.enqueue(60, 6);
+    pq.enqueue(30, 3);
+    pq.enqueue(61, 6);
+    pq.enqueue(90, 9);
+    pq.enqueue(62, 6);
+
+    SECTION("Test lower_bound() and upper_bound()") {
+        REQUIRE(*pq.lower_bound(2) == 20);
+        REQUIRE(*pq.lower_bound(4) == 50);
+        REQUIRE(pq.lower_bound(4).priority() == 5);
+        REQUIRE(*pq.upper_bound(5) == 60);
+        REQUIRE(*pq.upper_bound(1) == 20);
+        REQUIRE(pq.lower_bound(10) == prqueue<int>::iterator());
+        REQUIRE(pq.upper_bound(9) == prqueue<int>::iterator());
+    }
+
+    SECTION("Test range() walks [lo, hi) in order") {
+        vector<int> values;
+        for (int value : pq.range(3, 7)) {
+            values.push_back(value);
+        }
+        REQUIRE(values == vector<int>{30, 50, 60, 61, 62});
+
+        values.clear();
+        for (int value : pq.range(7, 3)) {
+            values.push_back(value);
+        }
+        REQUIRE(values.empty());
+    }
+
+    SECTION("Test count_range() through updates") {
+        REQUIRE(pq.count_range(0, 100) == 9);
+        REQUIRE(pq.count_range(2, 3) == 2);
+        REQUIRE(pq.count_range(3, 7) == 5);
+        REQUIRE(pq.count_range(6, 7) == 3);
+        REQUIRE(pq.count_range(10, 20) == 0);
+
+        pq.dequeue();   // 20
+        pq.dequeue();   // 21
+        REQUIRE(pq.count_range(0, 100) == 7);
+        REQUIRE(pq.count_range(2, 3) == 0);
+
+        vector<int> out;
+        pq.dequeue_ready(5, back_inserter(out));
+        REQUIRE(pq.count_range(0, 100) == 5);
+        REQUIRE(pq.count_range(6, 7) == 3);
+
+        prqueue<int> part = pq.split_half();
+        REQUIRE(part.count_range(0, 100) == part.size());
+        REQUIRE(pq.count_range(0, 100) == pq.size());
+        REQUIRE(part.size() + pq.size() == 5);
+    }
+
+    SECTION("Test count_range() against a brute-force count") {
+        prqueue<int> big;
+        for (int i = 0; i < 2000; i++) {
+            big.enqueue(i, (i * 7919) % 311);
+            if (i % 5 == 0) {
+                big.dequeue();
+            }
+        }
+        for (int lo = 0; lo < 311; lo += 17) {
+            for (int hi = lo; hi < 320; hi += 29) {
+                int expected = 0;
+                big.for_each(execution::seq, [&](const int&, int priority) {
+                    expected += (priority >= lo && priority < hi);
+                });
+                REQUIRE(big.count_range(lo, hi) == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE("Test kth() and rank() functions") {
+    SECTION("Test kth() and rank() on an empty priority queue") {
+        prqueue<int> pq;
+        REQUIRE(pq.kth(0) == prqueue<int>::iterator());
+        REQUIRE(pq.rank(5) == 0);
+    }
+
+    SECTION("Test kth() walks into duplicate chains") {
+        prqueue<string> pq;
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Jen", 2);
+        pq.enqueue("Ben", 1);
+        pq.enqueue("Sven", 2);
+        pq.enqueue("Len", 2);
+
+        REQUIRE(*pq.kth(0) == "Ben");
+        REQUIRE(*pq.kth(1) == "Jen");
+        REQUIRE(*pq.kth(2) == "Sven");
+        REQUIRE(*pq.kth(3) == "Len");
+        REQUIRE(*pq.kth(4) == "Gwen");
+        REQUIRE(pq.kth(4).priority() == 3);
+        REQUIRE(pq.kth(5) == prqueue<string>::iterator());
+        REQUIRE(pq.kth(-1) == prqueue<string>::iterator());
+
+        REQUIRE(pq.rank(1) == 0);
+        REQUIRE(pq.rank(2) == 1);
+        REQUIRE(pq.rank(3) == 4);
+        REQUIRE(pq.rank(100) == 5);
+
+        pq.dequeue();
+        pq.dequeue();
+        REQUIRE(*pq.kth(0) == "Sven");
+        REQUIRE(pq.rank(3) == 2);
+    }
+
+    SECTION("Test kth() and rank() against an in-order walk") {
+        prqueue<int> pq;
+        for (int i = 0; i < 1500; i++) {
+            pq.enqueue(i, (i * 7919) % 257);
+            if (i % 4 == 0) {
+                pq.dequeue();
+            }
+        }
+        vector<pair<int, int>> inorder;
+        pq.for_each(execution::seq, [&](const int& value, int priority) {
+            inorder.push_back({value, priority});
+        });
+        REQUIRE((int) inorder.size() == pq.size());
+        for (int k = 0; k < pq.size(); k += 7) {
+            auto it = pq.kth(k);
+            REQUIRE(*it == inorder[k].first);
+            REQUIRE(pq.rank(it.priority()) <= k);
+        }
+        int p99 = pq.kth(pq.size() * 99 / 100).priority();
+        REQUIRE(pq.rank(p99) <= pq.size() * 99 / 100);
+        REQUIRE(pq.rank(p99 + 1) > pq.size() * 99 / 100);
+    }
+}
+
+TEST_CASE("Test peek_max() and dequeue_max() functions") {
+    SECTION("Test peek_max() and dequeue_max() on an empty priority queue") {
+        prqueue<int> pq;
+        REQUIRE(pq.peek_max() == 0);
+        REQUIRE(pq.dequeue_max() == 0);
+        REQUIRE(pq.size() == 0);
+    }
+
+    SECTION("Test dequeue_max() pops duplicates from the tail") {
+        prqueue<string> pq;
+        pq.enqueue("Ben", 1);
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Jen", 2);
+        pq.enqueue("Sven", 3);
+
+        REQUIRE(pq.peek_max() == "Sven");
+        REQUIRE(pq.dequeue_max() == "Sven");
+        REQUIRE(pq.dequeue_max() == "Gwen");
+        REQUIRE(pq.peek_max() == "Jen");
+        REQUIRE(pq.dequeue() == "Ben");
+        REQUIRE(pq.dequeue_max() == "Jen");
+        REQUIRE(pq.size() == 0);
+        REQUIRE(pq.toString() == "");
+
+        pq.enqueue("Len", 4);
+        REQUIRE(pq.peek_max() == "Len");
+    }
+
+    SECTION("Test evicting from both ends against a sorted reference") {
+        prqueue<int> pq;
+        vector<pair<int, int>> ref;  // priority, value in queue order
+        unsigned seed = 99;
+        for (int i = 0; i < 3000; i++) {
+            seed = seed * 1103515245 + 12345;
+            int priority = (int) ((seed >> 8) % 200);
+            pq.enqueue(i, priority);
+            auto pos = upper_bound(ref.begin(), ref.end(), make_pair(priority, INT_MAX));
+            ref.insert(pos, {priority, i});
+
+            if (i % 3 == 0) {
+                REQUIRE(pq.dequeue_max() == ref.back().second);
+                ref.pop_back();
+            }
+            if (i % 5 == 0 && !ref.empty()) {
+                REQUIRE(pq.dequeue() == ref.front().second);
+                ref.erase(ref.begin());
+            }
+            if (!ref.empty()) {
+                REQUIRE(pq.peek_max() == ref.back().second);
+            }
+        }
+        REQUIRE(pq.size() == (int) ref.size());
+        REQUIRE(pq.count_range(INT_MIN, INT_MAX) == (int) ref.size());
+
+        prqueue<int> rebuilt;
+        for (auto& item : ref) {
+            rebuilt.enqueue(item.second, item.first);
+        }
+        REQUIRE(pq == rebuilt);
+        REQUIRE(pq.fingerprint() == rebuilt.fingerprint());
+    }
+}
+
+TEST_CASE("Test bounded capacity") {
+    SECTION("Test enqueue() rejects elements no better than the worst") {
+        prqueue<string> pq;
+        pq.set_capacity(2);
+        REQUIRE(pq.capacity() == 2);
+        REQUIRE(pq.enqueue("Ben", 1));
+        REQUIRE(pq.enqueue("Gwen", 3));
+        REQUIRE_FALSE(pq.enqueue("Sven", 3));
+        REQUIRE_FALSE(pq.enqueue("Len", 4));
+        REQUIRE(pq.enqueue("Jen", 2));
+        REQUIRE(pq.size() == 2);
+        REQUIRE(pq.toString() == "1 value: Ben\n2 value: Jen\n");
+    }
+
+    SECTION("Test set_capacity() shrinks and unbounds") {
+        prqueue<int> pq;
+        for (int i = 0; i < 10; i++) {
+            pq.enqueue(i, i);
+        }
+        pq.set_capacity(4);
+        REQUIRE(pq.size() == 4);
+        REQUIRE(pq.peek_max() == 3);
+        pq.set_capacity(0);
+        REQUIRE(pq.enqueue(50, 50));
+        REQUIRE(pq.size() == 5);
+    }
+
+    SECTION("Test top-k tracking against a sorted reference") {
+        const int k = 25;
+        prqueue<int> pq;
+        pq.set_capacity(k);
+        vector<int> scores;
+        unsigned seed = 7;
+        for (int i = 0; i < 5000; i++) {
+            seed = seed * 1103515245 + 12345;
+            int score = (int) ((seed >> 8) % 100000);
+            scores.push_back(score);
+            pq.enqueue(score, -score);
+        }
+        sort(scores.rbegin(), scores.rend());
+        REQUIRE(pq.size() == k);
+        REQUIRE(pq.count_range(INT_MIN, INT_MAX) == k);
+        for (int i = 0; i < k; i++) {
+            REQUIRE(pq.dequeue() == scores[i]);
+        }
+    }
+
+#ifdef PRQUEUE_STATS
+    SECTION("Test a full bounded queue recycles nodes") {
+        prqueue<int> pq;
+        pq.set_capacity(8);
+        for (int i = 1000; i > 0; i--) {
+            pq.enqueue(i, i);
+        }
+        REQUIRE(pq.stats().allocMisses == 8);
+        REQUIRE(pq.stats().allocHits == 992);
+    }
+#endif
+}
+
+TEST_CASE("Test cancel() function") {
+    SECTION("Test cancel() of solitary, chain head and chain member elements") {
+        prqueue<string> pq;
+        auto ben = pq.enqueue("Ben", 1);
+        auto jen = pq.enqueue("Jen", 2);
+        auto sven = pq.enqueue("Sven", 2);
+        pq.enqueue("Len", 2);
+        auto gwen = pq.enqueue("Gwen", 3);
+
+        REQUIRE(pq.cancel(sven));
+        REQUIRE(pq.size() == 4);
+        REQUIRE(pq.toString() == "1 value: Ben\n2 value: Jen\n2 value: Len\n3 value: Gwen\n");
+        REQUIRE(pq.cancel(jen));
+        REQUIRE(pq.cancel(ben));
+        REQUIRE(pq.peek() == "Len");
+        REQUIRE(pq.cancel(gwen));
+        REQUIRE(pq.peek_max() == "Len");
+        REQUIRE(pq.dequeue() == "Len");
+        REQUIRE(pq.size() == 0);
+        REQUIRE(pq.dequeue() == "");
+    }
+
+    SECTION("Test stale and repeated handles are ignored") {
+        prqueue<int> pq;
+        auto h = pq.enqueue(10, 1);
+        REQUIRE(pq.cancel(h));
+        REQUIRE_FALSE(pq.cancel(h));
+        REQUIRE_FALSE(pq.cancel(prqueue<int>::handle()));
+
+        auto h2 = pq.enqueue(20, 1);
+        REQUIRE(pq.dequeue() == 20);
+        pq.enqueue(30, 1);   // may reuse the node of h2
+        REQUIRE_FALSE(pq.cancel(h2));
+        REQUIRE(pq.size() == 1);
+        REQUIRE(pq.peek() == 30);
+    }
+
+    SECTION("Test next() and iterators skip cancelled elements") {
+        prqueue<int> pq;
+        vector<prqueue<int>::handle> handles;
+        for (int i = 0; i < 10; i++) {
+            handles.push_back(pq.enqueue(i, i / 3));
+        }
+        for (int i = 0; i < 10; i += 2) {
+            pq.cancel(handles[i]);
+        }
+        vector<int> seen;
+        int value, priority;
+        pq.begin();
+        while (pq.next(value, priority)) {
+            seen.push_back(value);
+        }
+        REQUIRE(seen == vector<int>{1, 3, 5, 7, 9});
+        seen.clear();
+        for (int v : pq.range(INT_MIN, INT_MAX)) {
+            seen.push_back(v);
+        }
+        REQUIRE(seen == vector<int>{1, 3, 5, 7, 9});
+    }
+
+    SECTION("Test cancel() against a reference under random operations") {
+        struct ITEM {
+            int value;
+            int priority;
+            prqueue<int>::handle h;
+        };
+        prqueue<int> pq;
+        vector<ITEM> live;   // in FIFO order within each priority
+        unsigned seed = 11;
+        auto rnd = [&seed](unsigned n) {
+            seed = seed * 1103515245 + 12345;
+            return (seed >> 8) % n;
+        };
+        auto best = [&live]() {
+            size_t b = 0;
+            for (size_t i = 1; i < live.size(); i++) {
+                if (live[i].priority < live[b].priority) {
+                    b = i;
+                }
+            }
+            return b;
+        };
+
+        for (int step = 0; step < 6000; step++) {
+            unsigned op = rnd(10);
+            if (op < 5 || live.empty()) {
+                int priority = (int) rnd(50);
+                live.push_back({step, priority, pq.enqueue(step, priority)});
+            } else if (op < 8) {
+                size_t i = rnd((unsigned) live.size());
+                REQUIRE(pq.cancel(live[i].h));
+                live.erase(live.begin() + i);
+            } else {
+                size_t b = best();
+                REQUIRE(pq.dequeue() == live[b].value);
+                live.erase(live.begin() + b);
+            }
+            REQUIRE(pq.size() == (int) live.size());
+
+            if (step % 500 == 0) {
+                vector<pair<int, int>> items;
+                for (ITEM& item : live) {
+                    items.push_back({item.value, item.priority});
+                }
+                prqueue<int> ref;
+                ref.assign(execution::seq, items.begin(), items.end());
+                REQUIRE(pq == ref);
+                prqueue<int> copy = pq;
+                REQUIRE(copy == ref);
+                REQUIRE(pq.count_range(10, 30) == ref.count_range(10, 30));
+                if (!live.empty()) {
+                    REQUIRE(*pq.kth((int) live.size() / 2) == *ref.kth((int) live.size() / 2));
+                }
+                REQUIRE(pq.fingerprint() == ref.fingerprint());
+                REQUIRE(pq.toString() == ref.toString());
+            }
+        }
+    }
+
+    SECTION("Test cancel() in a bounded queue") {
+        prqueue<int> pq;
+        pq.set_capacity(3);
+        pq.enqueue(1, 1);
+        pq.enqueue(2, 2);
+        auto h = pq.enqueue(3, 3);
+        REQUIRE(pq.cancel(h));
+        REQUIRE(pq.enqueue(4, 4));
+        REQUIRE(pq.size() == 3);
+        REQUIRE(pq.peek_max() == 4);
+        REQUIRE(pq.enqueue(0, 0));
+        REQUIRE(pq.peek_max() == 2);
+        REQUIRE(pq.dequeue_max() == 2);
+        REQUIRE(pq.size() == 2);
+    }
+
+    SECTION("Test copying cancelled elements into a bounded queue") {
+        prqueue<int> src;
+        vector<prqueue<int>::handle> handles;
+        for (int i = 0; i < 10; i++) {
+            handles.push_back(src.enqueue(i, i));
+        }
+        REQUIRE(src.cancel(handles[4]));
+        prqueue<int> dst;
+        dst.set_capacity(2);
+        dst.enqueue(100, 100);
+        dst = src;
+        REQUIRE(dst.size() == 9);
+        REQUIRE(dst.capacity() == 0);
+        REQUIRE(dst == src);
+
+        src.set_capacity(5);
+        dst.set_capacity(2);
+        dst = src;
+        REQUIRE(dst.size() == 5);
+        REQUIRE(dst.capacity() == 5);
+        REQUIRE(dst == src);
+    }
+
+#ifdef PRQUEUE_STATS
+    SECTION("Test repeated copies and clear() reuse nodes") {
+        prqueue<int> src;
+        for (int i = 0; i < 1000; i++) {
+            src.enqueue(i, i % 37);
+        }
+        prqueue<int> snap;
+        for (int i = 0; i < 10; i++) {
+            snap = src;
+        }
+        REQUIRE(snap == src);
+        REQUIRE(snap.stats().allocMisses == 1000);
+        REQUIRE(snap.stats().allocHits == 9000);
+
+        vector<pair<int, int>> items(1000, {1, 1});
+        snap.assign(execution::seq, items.begin(), items.end());
+        REQUIRE(snap.stats().allocMisses == 1000);
+
+        snap.clear();
+        snap.enqueue(1, 1);
+        REQUIRE(snap.stats().allocMisses == 1001);
+    }
+
+    SECTION("Test freed nodes are bounded unless handles are tracked") {
+        prqueue<int> plain;
+        prqueue<int> tracked;
+        tracked.track_handles();
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 1000; i++) {
+                plain.enqueue(i, i % 7);
+                tracked.enqueue(i, i % 7);
+            }
+            while (plain.size() > 0) {
+                plain.dequeue();
+                tracked.dequeue();
+            }
+        }
+        int keep = prqueue<int>::FREE_KEEP;
+        REQUIRE(plain.stats().allocHits == (uint64_t) keep);
+        REQUIRE(plain.stats().allocMisses == (uint64_t) (2000 - keep));
+        REQUIRE(tracked.stats().allocHits == 1000);
+        REQUIRE(tracked.stats().allocMisses == 1000);
+    }
+#endif
+}
+
+TEST_CASE("Test try_dequeue() and peek_ref() functions") {
+    SECTION("Test an empty queue is not confused with a T{} element") {
+        prqueue<int> pq;
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+        REQUIRE(pq.peek_ref() == nullptr);
+        pq.enqueue(0, 5);
+        REQUIRE(pq.peek_ref() != nullptr);
+        REQUIRE(*pq.peek_ref() == 0);
+        optional<int> value = pq.try_dequeue();
+        REQUIRE(value.has_value());
+        REQUIRE(*value == 0);
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+    }
+
+    SECTION("Test try_dequeue() keeps priority and FIFO order") {
+        prqueue<string> pq;
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Jen", 2);
+        pq.enqueue("Sven", 2);
+        pq.enqueue("Ben", 1);
+        REQUIRE(*pq.peek_ref() == "Ben");
+        vector<string> out;
+        while (optional<string> value = pq.try_dequeue()) {
+            out.push_back(*value);
+        }
+        REQUIRE(out == vector<string>{"Ben", "Jen", "Sven", "Gwen"});
+        REQUIRE(pq.size() == 0);
+    }
+
+    SECTION("Test try_dequeue() moves the value out") {
+        prqueue<vector<int>> pq;
+        pq.enqueue(vector<int>(1000, 7), 1);
+        const vector<int>* stored = pq.peek_ref();
+        const int* data = stored->data();
+        optional<vector<int>> value = pq.try_dequeue();
+        REQUIRE(value->size() == 1000);
+        REQUIRE(value->data() == data);
+    }
+
+    SECTION("Test try_dequeue() skips cancelled elements") {
+        prqueue<int> pq;
+        auto h = pq.enqueue(1, 1);
+        pq.enqueue(2, 2);
+        pq.cancel(h);
+        REQUIRE(*pq.peek_ref() == 2);
+        REQUIRE(*pq.try_dequeue() == 2);
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+    }
+}
+
+TEST_CASE("Test inline_task") {
+    SECTION("Test small closures are stored inline, large ones on the heap") {
+        int hits = 0;
+        auto small = [&hits]() { hits++; };
+        struct BIG {
+            int* hits;
+            char pad[64];
+            void operator()() { (*hits) += 10; }
+        };
+        REQUIRE(inline_task::fits_inline<decltype(small)>);
+        REQUIRE_FALSE(inline_task::fits_inline<BIG>);
+
+        inline_task a(small);
+        inline_task b(BIG{&hits, {}});
+        a();
+        b();
+        REQUIRE(hits == 11);
+
+        inline_task c(move(b));
+        REQUIRE_FALSE(b);
+        c();
+        REQUIRE(hits == 21);
+    }
+
+    SECTION("Test move-only captures and destruction") {
+        shared_ptr<int> counter = make_shared<int>(0);
+        unique_ptr<int> owned = make_unique<int>(5);
+        {
+            inline_task t([counter, p = move(owned)]() { *counter += *p; });
+            REQUIRE(counter.use_count() == 2);
+            inline_task u;
+            u = move(t);
+            u();
+            REQUIRE(*counter == 5);
+            u = nullptr;
+            REQUIRE(counter.use_count() == 1);
+        }
+        REQUIRE(counter.use_count() == 1);
+    }
+
+    SECTION("Test task_queue runs tasks in priority order") {
+        task_queue pq;
+        vector<int> order;
+        shared_ptr<int> counter = make_shared<int>(0);
+        for (int i = 0; i < 20; i++) {
+            pq.enqueue([&order, i, counter]() { order.push_back(i); }, (i * 7) % 5);
+        }
+        auto h = pq.enqueue([&order, counter]() { order.push_back(-1); }, 0);
+        REQUIRE(counter.use_count() == 22);
+        pq.cancel(h);
+        while (optional<inline_task> task = pq.try_dequeue()) {
+            (*task)();
+        }
+        REQUIRE(order == vector<int>{0, 5, 10, 15, 3, 8, 13, 18, 1, 6, 11, 16,
+                                     4, 9, 14, 19, 2, 7, 12, 17});
+        REQUIRE(counter.use_count() == 1);
+
+        pq.enqueue([counter]() {}, 1);
+        pq.clear();
+        REQUIRE(counter.use_count() == 1);
+    }
+}
+
+TEST_CASE("Test splay_prqueue") {
+    SECTION("Test FIFO order among duplicates") {
+        splay_prqueue<string> pq;
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Jen", 2);
+        pq.enqueue("Ben", 1);
+        pq.enqueue("Sven", 2);
+        REQUIRE(pq.size() == 4);
+        REQUIRE(pq.toString() == "1 value: Ben\n2 value: Jen\n2 value: Sven\n3 value: Gwen\n");
+        REQUIRE(pq.peek() == "Ben");
+        REQUIRE(pq.dequeue() == "Ben");
+        REQUIRE(pq.dequeue() == "Jen");
+        REQUIRE(*pq.peek_ref() == "Sven");
+        REQUIRE(pq.dequeue() == "Sven");
+        REQUIRE(*pq.try_dequeue() == "Gwen");
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+        REQUIRE(pq.dequeue() == "");
+    }
+
+    SECTION("Test a value type without a default constructor") {
+        struct job {
+            int id;
+            explicit job(int i) : id(i) {}
+        };
+        splay_prqueue<job> pq;
+        for (int i = 0; i < 100; i++) {
+            pq.enqueue(job(i), (i * 37) % 100);
+        }
+        REQUIRE(pq.peek_ref()->id == 0);
+        for (int i = 0; i < 100; i++) {
+            optional<job> next = pq.try_dequeue();
+            REQUIRE(next.has_value());
+            REQUIRE((next->id * 37) % 100 == i);
+        }
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+    }
+
+    SECTION("Test against prqueue under random operations") {
+        splay_prqueue<int> pq;
+        prqueue<int> ref;
+        unsigned seed = 17;
+        for (int step = 0; step < 20000; step++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned r = seed >> 8;
+            if (r % 5 < 3 || ref.size() == 0) {
+                int priority = (int) (r % 300);
+                pq.enqueue(step, priority);
+                ref.enqueue(step, priority);
+            } else {
+                int p1, p2;
+                REQUIRE(pq.peek_priority(p1));
+                REQUIRE(ref.peek_priority(p2));
+                REQUIRE(p1 == p2);
+                REQUIRE(pq.dequeue() == ref.dequeue());
+            }
+            REQUIRE(pq.size() == ref.size());
+        }
+        REQUIRE(pq.toString() == ref.toString());
+    }
+
+    SECTION("Test sorted input builds a long path that clear() handles") {
+        splay_prqueue<int> pq;
+        for (int i = 0; i < 200000; i++) {
+            pq.enqueue(i, i);
+        }
+        REQUIRE(pq.size() == 200000);
+        pq.clear();
+        REQUIRE(pq.size() == 0);
+        for (int i = 200000; i > 0; i--) {
+            pq.enqueue(i, i);
+        }
+        REQUIRE(pq.dequeue() == 1);
+    }
+}
+
+// Runs random enqueue/decrease_key/dequeue operations on Queue and on a
+// prqueue and requires both to return the same elements in the same order.
+template<typename Queue>
+static void checkDecreaseKey(unsigned seed) {
+    Queue pq;
+    prqueue<int> ref;
+    vector<typename Queue::handle> handles;
+    vector<prqueue<int>::handle> refHandles;
+    vector<int> prio;
+    vector<bool> queued;
+    for (int step = 0; step < 20000; step++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = seed >> 8;
+        if (r % 3 == 0 || ref.size() == 0) {
+            int priority = 1000 + (int) (r % 500);
+            handles.push_back(pq.enqueue((int) handles.size(), priority));
+            refHandles.push_back(ref.enqueue((int) refHandles.size(), priority));
+            prio.push_back(priority);
+            queued.push_back(true);
+        } else if (r % 3 == 1) {
+            int i = (int) ((r / 3) % handles.size());
+            if (queued[i]) {
+                int priority = prio[i] - (int) (r % 200);
+                handles[i] = pq.decrease_key(handles[i], priority);
+                refHandles[i] = ref.decrease_key(refHandles[i], priority);
+                prio[i] = priority < prio[i] ? priority : prio[i];
+            }
+        } else {
+            int p1, p2;
+            REQUIRE(pq.peek_priority(p1));
+            REQUIRE(ref.peek_priority(p2));
+            REQUIRE(p1 == p2);
+            int v = pq.dequeue();
+            REQUIRE(v == ref.dequeue());
+            queued[v] = false;
+        }
+        REQUIRE(pq.size() == ref.size());
+    }
+    while (ref.size() > 0) {
+        REQUIRE(pq.dequeue() == ref.dequeue());
+    }
+    REQUIRE_FALSE(pq.try_dequeue().has_value());
+}
+
+TEST_CASE("Test decrease_key() backends") {
+    SECTION("Test prqueue::decrease_key() moves the element behind its new priority") {
+        prqueue<string> pq;
+        pq.enqueue("Ben", 1);
+        pq.enqueue("Jen", 2);
+        auto h = pq.enqueue("Gwen", 5);
+        auto moved = pq.decrease_key(h, 2);
+        REQUIRE(moved);
+        REQUIRE(pq.size() == 3);
+        REQUIRE(pq.toString() == "1 value: Ben\n2 value: Jen\n2 value: Gwen\n");
+        REQUIRE_FALSE(pq.decrease_key(h, 0));   // h went stale
+        REQUIRE(pq.decrease_key(moved, 3).node == moved.node);
+        REQUIRE(pq.fingerprint() != 0);
+    }
+
+    SECTION("Test pairing_heap keeps FIFO order among equal priorities") {
+        pairing_heap<int> pq;
+        auto a = pq.enqueue(1, 5);
+        pq.enqueue(2, 3);
+        pq.enqueue(3, 3);
+        pq.decrease_key(a, 3);
+        REQUIRE(pq.dequeue() == 2);
+        REQUIRE(pq.dequeue() == 3);
+        REQUIRE(pq.dequeue() == 1);
+        REQUIRE(pq.dequeue() == 0);
+    }
+
+    SECTION("Test backends against prqueue under random operations") {
+        checkDecreaseKey<pairing_heap<int>>(19);
+        checkDecreaseKey<rank_pairing_heap<int>>(23);
+    }
+}
+
+TEST_CASE("Test freeze() function") {
+    SECTION("Test an empty queue freezes to an empty snapshot") {
+        prqueue<int> pq;
+        frozen_prqueue<int> frozen = pq.freeze();
+        REQUIRE(frozen.size() == 0);
+        REQUIRE(frozen.begin() == frozen.end());
+        REQUIRE(frozen.lower_bound(0) == frozen.end());
+    }
+
+    SECTION("Test duplicates are stored adjacently in FIFO order") {
+        prqueue<string> pq;
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Jen", 2);
+        pq.enqueue("Ben", 1);
+        pq.enqueue("Sven", 2);
+        frozen_prqueue<string> frozen = pq.freeze();
+        vector<string> out;
+        for (const string& value : frozen) {
+            out.push_back(value);
+        }
+        REQUIRE(out == vector<string>{"Ben", "Jen", "Sven", "Gwen"});
+        auto twos = frozen.find(2);
+        REQUIRE(twos.last - twos.first == 2);
+        REQUIRE(*twos.first == "Jen");
+        REQUIRE(frozen.find(4).first == frozen.find(4).last);
+        REQUIRE(pq.size() == 4);
+    }
+
+    SECTION("Test searches match prqueue for random contents") {
+        for (int n : {1, 2, 3, 7, 8, 100, 5000}) {
+            prqueue<int> pq;
+            unsigned seed = (unsigned) n;
+            for (int i = 0; i < n; i++) {
+                seed = seed * 1103515245 + 12345;
+                pq.enqueue(i, (int) ((seed >> 8) % (unsigned) (n * 2)));
+            }
+            frozen_prqueue<int> frozen = pq.freeze();
+            REQUIRE(frozen.size() == pq.size());
+
+            auto it = pq.lower_bound(INT_MIN);
+            for (auto f = frozen.begin(); f != frozen.end(); ++f, ++it) {
+                REQUIRE(*f == *it);
+                REQUIRE(f.priority() == it.priority());
+            }
+            for (int p = -1; p <= n * 2 + 1; p++) {
+                auto a = pq.lower_bound(p);
+                auto b = frozen.lower_bound(p);
+                REQUIRE((a == decltype(a)()) == (b == frozen.end()));
+                if (b != frozen.end()) {
+                    REQUIRE(*a == *b);
+                }
+                auto c = pq.upper_bound(p);
+                auto d = frozen.upper_bound(p);
+                REQUIRE((c == decltype(c)()) == (d == frozen.end()));
+                if (d != frozen.end()) {
+                    REQUIRE(*c == *d);
+                }
+                REQUIRE(frozen.count_range(p, p + 5) == pq.count_range(p, p + 5));
+            }
+            REQUIRE(*frozen.kth(n / 2) == *pq.kth(n / 2));
+        }
+    }
+
+    SECTION("Test extreme priorities") {
+        prqueue<int> pq;
+        pq.enqueue(1, INT_MAX);
+        pq.enqueue(2, INT_MIN);
+        pq.enqueue(3, 0);
+        frozen_prqueue<int> frozen = pq.freeze();
+        REQUIRE(*frozen.lower_bound(INT_MIN) == 2);
+        REQUIRE(*frozen.lower_bound(1) == 1);
+        REQUIRE(*frozen.lower_bound(INT_MAX) == 1);
+        REQUIRE(frozen.upper_bound(INT_MAX) == frozen.end());
+        REQUIRE(frozen.count_range(INT_MIN, INT_MAX) == 2);
+    }
+}
+
+TEST_CASE("Test persistent_prqueue") {
+    SECTION("Test versions are independent") {
+        persistent_prqueue<string> v0;
+        persistent_prqueue<string> v1 = v0.enqueue("Gwen", 3).enqueue("Jen", 2);
+        persistent_prqueue<string> v2 = v1.enqueue("Ben", 1).enqueue("Sven", 2);
+        persistent_prqueue<string> v3 = v2.dequeue();
+
+        REQUIRE(v0.size() == 0);
+        REQUIRE(v0.toString() == "");
+        REQUIRE(v1.toString() == "2 value: Jen\n3 value: Gwen\n");
+        REQUIRE(v2.toString() == "1 value: Ben\n2 value: Jen\n2 value: Sven\n3 value: Gwen\n");
+        REQUIRE(v3.toString() == "2 value: Jen\n2 value: Sven\n3 value: Gwen\n");
+        REQUIRE(v2.peek() == "Ben");
+        REQUIRE(v3.peek() == "Jen");
+        REQUIRE(v0.peek_ref() == nullptr);
+        REQUIRE(v0.dequeue().size() == 0);
+    }
+
+    SECTION("Test against prqueue, keeping every version") {
+        prqueue<int> ref;
+        persistent_prqueue<int> pq;
+        vector<pair<persistent_prqueue<int>, string>> history;
+        unsigned seed = 29;
+        for (int step = 0; step < 3000; step++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned r = seed >> 8;
+            if (r % 3 != 0 || ref.size() == 0) {
+                int priority = (int) (r % 100);
+                pq = pq.enqueue(step, priority);
+                ref.enqueue(step, priority);
+            } else {
+                REQUIRE(pq.peek() == ref.dequeue());
+                pq = pq.dequeue();
+            }
+            REQUIRE(pq.size() == ref.size());
+            if (step % 100 == 0) {
+                history.push_back({pq, ref.toString()});
+            }
+        }
+        for (auto& [version, expected] : history) {
+            REQUIRE(version.toString() == expected);
+        }
+    }
+}
+
+TEST_CASE("Test rcu_prqueue") {
+    SECTION("Test a read section keeps its version") {
+        rcu_prqueue<string> pq;
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Jen", 2);
+        {
+            auto view = pq.read();
+            pq.enqueue("Ben", 1);
+            REQUIRE(pq.dequeue() == "Ben");
+            REQUIRE(pq.dequeue() == "Jen");
+            REQUIRE(view->toString() == "2 value: Jen\n3 value: Gwen\n");
+            REQUIRE(pq.retired_count() == 3);
+        }
+        REQUIRE(pq.toString() == "3 value: Gwen\n");
+        pq.enqueue("Sven", 3);
+        REQUIRE(pq.retired_count() == 0);
+        REQUIRE(pq.size() == 2);
+        REQUIRE(pq.dequeue() == "Gwen");
+        REQUIRE(pq.try_dequeue() == "Sven");
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+        REQUIRE(pq.dequeue() == "");
+    }
+
+    SECTION("Test a snapshot outlives its read section") {
+        rcu_prqueue<int> pq;
+        pq.enqueue(1, 1);
+        persistent_prqueue<int> snap = pq.snapshot();
+        pq.dequeue();
+        pq.enqueue(2, 2);
+        REQUIRE(pq.retired_count() == 0);
+        REQUIRE(snap.toString() == "1 value: 1\n");
+        REQUIRE(pq.toString() == "2 value: 2\n");
+    }
+
+    SECTION("Test readers traverse while writers mutate") {
+        rcu_prqueue<int> pq;
+        atomic<bool> done(false);
+        atomic<int> badViews(0);
+        vector<thread> readers;
+        for (int t = 0; t < 3; t++) {
+            readers.emplace_back([&]() {
+                while (!done) {
+                    auto view = pq.read();
+                    int count = 0;
+                    int last = INT_MIN;
+                    view->for_each([&](int value, int priority) {
+                        if (priority < last || value % 1000 != priority) {
+                            badViews++;
+                        }
+                        last = priority;
+                        count++;
+                    });
+                    if (count != view->size()) {
+                        badViews++;
+                    }
+                }
+            });
+        }
+        vector<thread> writers;
+        for (int t = 0; t < 2; t++) {
+            writers.emplace_back([&, t]() {
+                for (int i = 0; i < 2000; i++) {
+                    int priority = (i * 7 + t) % 1000;
+                    pq.enqueue(priority + 1000 * t, priority);
+                    if (i % 3 == 0) {
+                        pq.dequeue();
+                    }
+                }
+            });
+        }
+        for (auto& w : writers) {
+            w.join();
+        }
+        done = true;
+        for (auto& r : readers) {
+            r.join();
+        }
+        REQUIRE(badViews == 0);
+        REQUIRE(pq.size() == 2 * (2000 - 667));
+        pq.enqueue(0, 0);
+        REQUIRE(pq.retired_count() == 0);
+    }
+}
+
+TEST_CASE("Test set_arena() function") {
+    SECTION("Test nodes come from the arena") {
+        node_arena arena(prqueue<string>::NODE_SIZE);
+        prqueue<string> pq;
+        REQUIRE(pq.set_arena(&arena));
+        REQUIRE(pq.get_arena() == &arena);
+        REQUIRE(arena.reserved() == 0);
+        for (int i = 0; i < 1000; i++) {
+            pq.enqueue(to_string(i), i % 10);
+        }
+        REQUIRE(arena.reserved() > 0);
+        REQUIRE_FALSE(pq.set_arena(nullptr)); // not empty
+
+        prqueue<string> half = pq.split_half();
+        REQUIRE(half.get_arena() == &arena);
+        prqueue<string> copy = pq;
+        REQUIRE(copy.get_arena() == nullptr);
+        REQUIRE(copy.toString() == pq.toString());
+        REQUIRE(half.size() + pq.size() == 1000);
+        REQUIRE(half.dequeue() == "0");
+
+        pq.clear();
+        REQUIRE(pq.set_arena(nullptr));
+        pq.enqueue("heap", 1);
+        REQUIRE(pq.dequeue() == "heap");
+    }
+
+    SECTION("Test blocks too small for a node are refused") {
+        node_arena arena(8);
+        prqueue<int> pq;
+        REQUIRE_FALSE(pq.set_arena(&arena));
+        REQUIRE(pq.get_arena() == nullptr);
+    }
+
+    SECTION("Test an arena bound to a NUMA node") {
+        node_arena arena(prqueue<int>::NODE_SIZE, node_arena::current_node());
+        prqueue<int> pq;
+        REQUIRE(pq.set_arena(&arena));
+        for (int i = 0; i < 100000; i++) {
+            pq.enqueue(i, 100000 - i);
+        }
+        REQUIRE(arena.reserved() >= 100000 * prqueue<int>::NODE_SIZE);
+        REQUIRE(pq.dequeue() == 99999);
+        REQUIRE(pq.size() == 99999);
+    }
+
+    SECTION("Test a hugepage arena") {
+        node_arena raw(64, -1, true);
+        void* block = raw.allocate();
+        REQUIRE((uintptr_t) block % node_arena::CHUNK_SIZE == 0); // huge pages need alignment
+        raw.deallocate(block);
+        REQUIRE(raw.allocate() == block);
+
+        node_arena arena(prqueue<int>::NODE_SIZE, -1, true);
+        prqueue<int> pq;
+        REQUIRE(pq.set_arena(&arena));
+        for (int i = 0; i < 100000; i++) {
+            pq.enqueue(i, i % 1000);
+        }
+        REQUIRE(arena.reserved() % node_arena::CHUNK_SIZE == 0);
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(pq.dequeue() == i * 1000);
+        }
+        pq.clear();
+        REQUIRE(pq.size() == 0);
+    }
+}
+
+TEST_CASE("Test numa_prqueue") {
+    SECTION("Test local elements come first, then stealing") {
+        numa_prqueue<int> nq(2);
+        REQUIRE(nq.socket_count() == 2);
+        nq.enqueue(10, 10, 0);
+        nq.enqueue(5, 5, 0);
+        nq.enqueue(1, 1, 1);
+        nq.enqueue(2, 2, 1);
+        int value;
+        int priority;
+        REQUIRE(nq.dequeue(value, priority, 0));
+        REQUIRE(value == 5);
+        REQUIRE(nq.dequeue(value, priority, 0));
+        REQUIRE(value == 10);
+        REQUIRE(nq.steals() == 0);
+        REQUIRE(nq.dequeue(value, priority, 0));
+        REQUIRE(value == 1);
+        REQUIRE(priority == 1);
+        REQUIRE(nq.steals() == 1);
+        REQUIRE(nq.size() == 1);
+        REQUIRE(nq.dequeue(value, priority, 1));
+        REQUIRE(value == 2);
+        REQUIRE_FALSE(nq.dequeue(value, priority));
+        REQUIRE(nq.size() == 0);
+    }
+
+    SECTION("Test concurrent producers and consumers") {
+        numa_prqueue<int> nq(3);
+        atomic<long> sum(0);
+        atomic<int> taken(0);
+        vector<thread> workers;
+        for (int t = 0; t < 3; t++) {
+            workers.emplace_back([&, t]() {
+                for (int i = 0; i < 2000; i++) {
+                    nq.enqueue(i, i % 17, t);
+                }
+                int value;
+                int priority;
+                while (taken < 6000) {
+                    if (nq.dequeue(value, priority, (t + 1) % 3)) {
+                        sum += value;
+                        taken++;
+                    }
+                }
+            });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        REQUIRE(sum == 3 * (1999L * 2000 / 2));
+        REQUIRE(nq.size() == 0);
+    }
+}
+
+TEST_CASE("Test enqueue_bulk() function") {
+    SECTION("Test enqueue_bulk() matches a loop of enqueue()") {
+        for (int round = 0; round < 20; round++) {
+            prqueue<int> bulk;
+            prqueue<int> loop;
+            unsigned seed = round * 7919 + 1;
+            for (int batch = 0; batch < 10; batch++) {
+                vector<pair<int, int>> items;
+                int count = (int) (seed % 50);
+                for (int i = 0; i < count; i++) {
+                    seed = seed * 1103515245 + 12345;
+                    items.push_back({batch * 100 + i, (int) ((seed >> 8) % 40)});
+                }
+                bulk.enqueue_bulk(items.begin(), items.end());
+                for (auto& [value, priority] : items) {
+                    loop.enqueue(value, priority);
+                }
+                REQUIRE(bulk.toString() == loop.toString());
+                REQUIRE(bulk.size() == loop.size());
+                REQUIRE(bulk.fingerprint() == loop.fingerprint());
+                if (batch % 3 == 2) {
+                    REQUIRE(bulk.dequeue() == loop.dequeue());
+                }
+            }
+            REQUIRE(*bulk.kth(bulk.size() / 2) == *loop.kth(loop.size() / 2));
+        }
+    }
+
+    SECTION("Test enqueue_bulk() with cancelled elements and a capacity") {
+        prqueue<string> pq;
+        auto ben = pq.enqueue("Ben", 2);
+        pq.enqueue("Jen", 2);
+        pq.cancel(ben);
+        vector<pair<string, int>> items = {{"Gwen", 1}, {"Sven", 2}, {"Ken", 3}};
+        pq.enqueue_bulk(items.begin(), items.end());
+        REQUIRE(pq.toString() == "1 value: Gwen\n2 value: Jen\n2 value: Sven\n3 value: Ken\n");
+
+        pq.set_capacity(3);
+        vector<pair<string, int>> more = {{"Len", 0}, {"Zen", 9}};
+        pq.enqueue_bulk(more.begin(), more.end());
+        REQUIRE(pq.toString() == "0 value: Len\n1 value: Gwen\n2 value: Jen\n");
+    }
+}
+
+// Consumer coroutine for the async_prqueue tests: takes count elements and
+// records (id, element) for each.
+static async_task asyncConsumer(async_prqueue<int>& q, int id, int waiterPriority, int count,
+                                vector<pair<int, int>>& got) {
+    for (int i = 0; i < count; i++) {
+        int value = co_await q.async_dequeue(waiterPriority);
+        got.push_back({id, value});
+    }
+}
+
+TEST_CASE("Test async_prqueue") {
+    SECTION("Test queued elements complete co_await at once") {
+        async_executor exec;
+        async_prqueue<int> q(exec);
+        vector<pair<int, int>> got;
+        q.enqueue(30, 3);
+        q.enqueue(10, 1);
+        q.enqueue(20, 2);
+        exec.spawn(asyncConsumer(q, 7, 0, 2, got));
+        REQUIRE(exec.run() == 1);
+        REQUIRE(got == vector<pair<int, int>>{{7, 10}, {7, 20}});
+        REQUIRE(q.size() == 1);
+        REQUIRE(q.waiting() == 0);
+        REQUIRE(q.try_dequeue() == 30);
+        REQUIRE_FALSE(q.try_dequeue().has_value());
+    }
+
+    SECTION("Test a consumer suspends until an element arrives") {
+        async_executor exec;
+        async_prqueue<int> q(exec);
+        vector<pair<int, int>> got;
+        exec.spawn(asyncConsumer(q, 1, 0, 3, got));
+        exec.run();
+        REQUIRE(q.waiting() == 1);
+        REQUIRE(got.empty());
+        q.enqueue(5, 5);
+        q.enqueue(6, 6);  // queued: the consumer has not resumed yet
+        REQUIRE(q.size() == 1);
+        REQUIRE(exec.pending() == 1);
+        exec.run();
+        REQUIRE(got == vector<pair<int, int>>{{1, 5}, {1, 6}});
+        REQUIRE(q.waiting() == 1);
+        // The queue destroys the still suspended consumer.
+    }
 
+    SECTION("Test 100K suspended consumers are served by waiter priority") {
+        const int n = 100000;
+        async_executor exec;
+        async_prqueue<int> q(exec);
+        vector<pair<int, int>> got;
+        got.reserve(n);
+        for (int id = 0; id < n; id++) {
+            exec.spawn(asyncConsumer(q, id, id % 10, 1, got));
+        }
+        REQUIRE(exec.run() == (size_t) n);
+        REQUIRE(q.waiting() == n);
+        REQUIRE(got.empty());
+
+        for (int i = 0; i < n; i++) {
+            q.enqueue(i, n - i);
+        }
+        REQUIRE(q.waiting() == 0);
+        REQUIRE(q.size() == 0);
+        REQUIRE(exec.run() == (size_t) n);
+        REQUIRE((int) got.size() == n);
+        bool inOrder = true;
+        for (int k = 0; k < n; k++) {
+            // Waiters with priority 0 first, FIFO among equal priorities.
+            int expectedId = (k % (n / 10)) * 10 + k / (n / 10);
+            inOrder = inOrder && got[k] == pair<int, int>(expectedId, k);
+        }
+        REQUIRE(inOrder);
+    }
+}
+
+TEST_CASE("Test aging_prqueue") {
+    SECTION("Test priority order without waiting") {
+        aging_prqueue<string> pq(1000);
+        pq.enqueue("Gwen", 3);
+        pq.enqueue("Ben", 1);
+        pq.enqueue("Jen", 1);
+        int priority;
+        REQUIRE(pq.peek_priority(priority));
+        REQUIRE(priority == 1);
+        int64_t waited = -1;
+        REQUIRE(pq.dequeue(&waited) == "Ben");
+        REQUIRE(waited == 0);
+        REQUIRE(pq.dequeue() == "Jen");
+        REQUIRE(pq.dequeue(&waited) == "Gwen");
+        REQUIRE(waited == 2);
+        REQUIRE(pq.now() == 3);
+        REQUIRE_FALSE(pq.try_dequeue().has_value());
+        REQUIRE(pq.now() == 3);
+    }
 
+    SECTION("Test waiting elements overtake better priorities") {
+        aging_prqueue<int> pq(10);
+        pq.enqueue(-1, 5);            // key 50
+        for (int i = 0; i < 30; i++) {
+            pq.enqueue(i, 1);         // keys 10, 11, ... as the clock advances
+            REQUIRE(pq.dequeue() == i);
+        }
+        pq.advance(20);               // now 50: an element of priority 1 gets key 60
+        pq.enqueue(100, 1);
+        REQUIRE(pq.dequeue() == -1);
+        REQUIRE(pq.dequeue() == 100);
+    }
+
+    SECTION("Test strict priority starves, aging does not") {
+        prqueue<int> strict;
+        aging_prqueue<int> aging(50);
+        int strictLow = 0;
+        int agingLow = 0;
+        strict.enqueue(0, 2);
+        aging.enqueue(0, 2);
+        for (int tick = 0; tick < 1000; tick++) {
+            strict.enqueue(1, 0);
+            strict.enqueue(1, 0);
+            aging.enqueue(1, 0);
+            aging.enqueue(1, 0);
+            strictLow += strict.dequeue() == 0;
+            agingLow += aging.dequeue() == 0;
+        }
+        REQUIRE(strictLow == 0);
+        REQUIRE(agingLow == 1);
+    }
+
+    SECTION("Test emptied levels are dropped") {
+        aging_prqueue<int> pq(10);
+        for (int i = 0; i < 1000; i++) {
+            pq.enqueue(i, i);
+            pq.enqueue(i, i + 1);
+            REQUIRE(pq.dequeue() == i);
+            REQUIRE(pq.level_count() == 1);
+            REQUIRE(pq.dequeue() == i);
+            REQUIRE(pq.level_count() == 0);
+        }
+        pq.enqueue(7, 3);
+        pq.rebase();
+        REQUIRE(pq.level_count() == 1);
+        REQUIRE(pq.dequeue() == 7);
+        REQUIRE(pq.level_count() == 0);
+    }
+
+    SECTION("Test rebase keeps the order") {
+        aging_prqueue<int> pq(4);
+        aging_prqueue<int> twin(4);
+        for (int i = 0; i < 200; i++) {
+            pq.enqueue(i, (i * 37) % 11);
+            twin.enqueue(i, (i * 37) % 11);
+            if (i % 5 == 0) {
+                pq.dequeue();
+                twin.dequeue();
+            }
+        }
+        pq.rebase();
+        pq.enqueue(500, 3);
+        twin.enqueue(500, 3);
+        vector<int> order;
+        vector<int> twinOrder;
+        optional<int> value;
+        while ((value = pq.try_dequeue())) {
+            order.push_back(*value);
+        }
+        while ((value = twin.try_dequeue())) {
+            twinOrder.push_back(*value);
+        }
+        REQUIRE(order.size() == 161);
+        REQUIRE(order == twinOrder);
+    }
+
+    SECTION("Test the clock running far ahead triggers a rebase") {
+        aging_prqueue<int> pq(4);
+        for (int i = 0; i < 10; i++) {
+            pq.enqueue(i, 10);
+        }
+        pq.advance(aging_prqueue<int>::REBASE_AT);
+        pq.enqueue(1000, 0);   // the old elements have waited 2^30 ticks
+        int64_t waited;
+        for (int i = 0; i < 10; i++) {
+            REQUIRE(pq.dequeue(&waited) == i);
+            REQUIRE(waited == aging_prqueue<int>::REBASE_AT + i);
+        }
+        REQUIRE(pq.dequeue() == 1000);
+    }
+}
@@ -0,0 +1,176 @@
+/// @file timerwheel.h
+///
+/// Hierarchical timer wheel front end for deadline scheduling on prqueue.
+
+// Description: timer_wheel keeps near-term deadlines in three levels of 64
+// slots each (a horizon of 2^18 ticks) and spills anything farther away
+// into a prqueue keyed by due time.  Scheduling a near-term item is O(1);
+// advancing time walks the elapsed ticks, cascading items from coarser
+// levels into finer ones as their deadline approaches and pulling the next
+// block of far-future items out of the prqueue with dequeue_ready().
+// Items due at the same tick come out in the order they were scheduled.
+
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "prqueue.h"
+
+using namespace std;
+
+template<typename T>
+class timer_wheel {
+private:
+    static const int LEVELS = 3;
+    static const int BITS = 6;
+    static const int SLOTS = 1 << BITS;
+    static const int HORIZON_BITS = LEVELS * BITS;
+
+    typedef pair<T, int> ITEM;             // value and due tick
+
+    vector<ITEM> wheel[LEVELS][SLOTS];
+    vector<ITEM> overdue;                  // scheduled at or before now
+    prqueue<ITEM> far;                     // beyond the wheel horizon
+    int nowTick;
+    int inWheel;                           // # of items in wheel and overdue
+
+    // Places an item with due > nowTick in the wheel or the far queue.  The
+    // level is the lowest one above which due and nowTick agree, so an item
+    // reaches level 0 exactly when its due tick is less than one lap away.
+    void _place(ITEM item) {
+        int due = item.second;
+        for (int level = 0; level < LEVELS; level++) {
+            int shift = BITS * (level + 1);
+            if ((due >> shift) == (nowTick >> shift)) {
+                int slot = (due >> (BITS * level)) & (SLOTS - 1);
+                wheel[level][slot].push_back(move(item));
+                inWheel++;
+                return;
+            }
+        }
+        far.enqueue(move(item), due);
+    }
+
+    // Moves the items of wheel[level][slot] down to finer levels.
+    void _cascade(int level, int slot) {
+        vector<ITEM> items;
+        items.swap(wheel[level][slot]);
+        inWheel -= (int) items.size();
+        for (ITEM& item : items) {
+            _place(move(item));
+        }
+    }
+
+    // Pulls every far item that falls in nowTick's top-level block.
+    void _pullFar() {
+        vector<ITEM> items;
+        far.dequeue_ready(nowTick | ((1 << HORIZON_BITS) - 1), back_inserter(items));
+        for (ITEM& item : items) {
+            _place(move(item));
+        }
+    }
+
+public:
+    //
+    // constructor:
+    //
+    // Creates an empty wheel whose current time is start.
+    //
+    explicit timer_wheel(int start = 0) {
+        nowTick = start;
+        inWheel = 0;
+    }
+
+
+    //
+    // schedule:
+    //
+    // Adds value to fire at tick due.  Items due at or before the current
+    // time fire on the next advance, ahead of the others and sorted by due
+    // tick among themselves.
+    // O(1) within the horizon, O(logn + m) beyond it
+    //
+    void schedule(T value, int due) {
+        if (due <= nowTick) {
+            overdue.push_back(ITEM(move(value), due));
+            inWheel++;
+            return;
+        }
+        _place(ITEM(move(value), due));
+    }
+
+
+    //
+    // advance:
+    //
+    // Moves the current time to "to" and writes the value of every item due
+    // at or before it to out, in due order.  Returns the output iterator
+    // past the last value written.
+    // O(elapsed ticks + fired items) while the wheel holds items; empty
+    // stretches are skipped straight to the next far-queue block.
+    //
+    template<typename OutputIt>
+    OutputIt advance(int to, OutputIt out) {
+        stable_sort(overdue.begin(), overdue.end(),
+            [](const ITEM& a, const ITEM& b) { return a.second < b.second; });
+        for (ITEM& item : overdue) {
+            *out++ = move(item.first);
+        }
+        inWheel -= (int) overdue.size();
+        overdue.clear();
+
+        while (nowTick < to) {
+            if (inWheel == 0) {
+                // Nothing in the wheel: jump to the tick before the block
+                // holding the earliest far item, or straight to "to".
+                int due;
+                int skipTo = to;
+                if (far.peek_priority(due)) {
+                    int block = (due >> HORIZON_BITS) << HORIZON_BITS;
+                    if (block - 1 < skipTo) {
+                        skipTo = block - 1;
+                    }
+                }
+                if (skipTo > nowTick) {
+                    nowTick = skipTo;
+                    continue;
+                }
+            }
+
+            nowTick++;
+            if ((nowTick & ((1 << HORIZON_BITS) - 1)) == 0) {
+                _pullFar();
+            }
+            for (int level = LEVELS - 1; level > 0; level--) {
+                if ((nowTick & ((1 << (BITS * level)) - 1)) == 0) {
+                    _cascade(level, (nowTick >> (BITS * level)) & (SLOTS - 1));
+                }
+            }
+
+            vector<ITEM>& slot = wheel[0][nowTick & (SLOTS - 1)];
+            for (ITEM& item : slot) {
+                *out++ = move(item.first);
+            }
+            inWheel -= (int) slot.size();
+            slot.clear();
+        }
+        return out;
+    }
+
+
+    //
+    // now / size:
+    //
+    // Current tick, and # of scheduled items that have not fired yet.
+    // O(1)
+    //
+    int now() const {
+        return nowTick;
+    }
+
+    int size() {
+        return inWheel + far.size();
+    }
+};
@@ -0,0 +1,225 @@
+/// @file workstealing.h
+///
+/// Work-stealing task scheduler whose per-thread run queues are prqueues.
+
+// Description: ws_scheduler runs prioritized tasks on a fixed set of worker
+// threads.  Every worker owns a local prqueue; tasks spawned from a worker
+// go to its own queue, tasks spawned from outside are dealt round-robin.
+// A worker whose queue runs dry picks a random victim and steals the
+// highest-priority part of the victim's queue with prqueue::split_half(),
+// so urgent work migrates to idle threads in a single detach instead of
+// one task at a time.  Tasks are held as inline_task, so a closure with
+// a small capture is stored in its queue node without a separate
+// allocation.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "inlinetask.h"
+#include "prqueue.h"
+
+using namespace std;
+
+class ws_scheduler {
+private:
+    struct alignas(64) WORKER {
+        mutex lock;                      // guards local
+        task_queue local;                // tasks owned by this worker
+    };
+
+    vector<unique_ptr<WORKER>> workers;
+    vector<thread> threads;
+    atomic<long> pending;     // tasks spawned but not yet finished
+    atomic<bool> stopping;
+    atomic<size_t> nextWorker; // round-robin target for outside spawns
+    atomic<size_t> nsteals;   // successful steals, for diagnostics
+
+    mutex idleLock;           // guards the two condition variables
+    condition_variable workCv;
+    condition_variable doneCv;
+    atomic<int> sleepers;     // workers blocked on workCv
+
+    static inline thread_local ws_scheduler* tlsOwner = nullptr;
+    static inline thread_local size_t tlsIndex = 0;
+
+    // Pops the best local task of worker w.
+    bool _popLocal(WORKER& w, inline_task& task) {
+        lock_guard<mutex> guard(w.lock);
+        optional<inline_task> next = w.local.try_dequeue();
+        if (!next) {
+            return false;
+        }
+        task = move(*next);
+        return true;
+    }
+
+    // Steals the highest-priority half of a random victim into worker self.
+    bool _steal(size_t self, minstd_rand& rng) {
+        size_t n = workers.size();
+        if (n < 2) {
+            return false;
+        }
+        for (size_t attempt = 0; attempt < n; attempt++) {
+            size_t victim = rng() % n;
+            if (victim == self) {
+                continue;
+            }
+            task_queue stolen;
+            {
+                WORKER& v = *workers[victim];
+                unique_lock<mutex> guard(v.lock, try_to_lock);
+                if (!guard.owns_lock() || v.local.size() == 0) {
+                    continue;
+                }
+                stolen = v.local.split_half();
+            }
+
+            WORKER& me = *workers[self];
+            lock_guard<mutex> guard(me.lock);
+            if (me.local.size() == 0) {
+                me.local.swap(stolen);
+            } else {
+                int priority;
+                while (stolen.peek_priority(priority)) {
+                    me.local.enqueue(stolen.dequeue(), priority);
+                }
+            }
+            nsteals.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void _run(inline_task& task) {
+        task();
+        task = nullptr;
+        if (pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+            lock_guard<mutex> guard(idleLock);
+            doneCv.notify_all();
+        }
+    }
+
+    void _workerLoop(size_t self) {
+        tlsOwner = this;
+        tlsIndex = self;
+        minstd_rand rng((unsigned) self * 2654435761u + 1);
+        inline_task task;
+
+        while (!stopping.load(memory_order_acquire)) {
+            if (_popLocal(*workers[self], task) ||
+                (_steal(self, rng) && _popLocal(*workers[self], task))) {
+                _run(task);
+                continue;
+            }
+
+            // Nothing to run or steal: sleep until new work is spawned.  The
+            // timeout covers the race where work is spawned locally by
+            // another worker between our last scan and the wait.
+            unique_lock<mutex> guard(idleLock);
+            sleepers++;
+            workCv.wait_for(guard, chrono::milliseconds(1));
+            sleepers--;
+        }
+    }
+
+public:
+    //
+    // constructor:
+    //
+    // Starts nthreads worker threads, each with an empty local queue.
+    //
+    explicit ws_scheduler(size_t nthreads = thread::hardware_concurrency()) {
+        if (nthreads == 0) {
+            nthreads = 1;
+        }
+        pending = 0;
+        stopping = false;
+        nextWorker = 0;
+        nsteals = 0;
+        sleepers = 0;
+        for (size_t i = 0; i < nthreads; i++) {
+            workers.push_back(make_unique<WORKER>());
+        }
+        for (size_t i = 0; i < nthreads; i++) {
+            threads.emplace_back(&ws_scheduler::_workerLoop, this, i);
+        }
+    }
+
+    ws_scheduler(const ws_scheduler&) = delete;
+    ws_scheduler& operator=(const ws_scheduler&) = delete;
+
+    //
+    // destructor:
+    //
+    // Waits for every spawned task to finish, then stops the workers.
+    //
+    ~ws_scheduler() {
+        wait();
+        stopping.store(true, memory_order_release);
+        {
+            lock_guard<mutex> guard(idleLock);
+            workCv.notify_all();
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+
+    //
+    // spawn:
+    //
+    // Queues a task; lower priority values run first.  Tasks spawned from a
+    // worker thread of this scheduler go to that worker's local queue.
+    //
+    void spawn(inline_task task, int priority = 0) {
+        pending.fetch_add(1, memory_order_relaxed);
+        size_t target = (tlsOwner == this)
+            ? tlsIndex
+            : nextWorker.fetch_add(1, memory_order_relaxed) % workers.size();
+        {
+            WORKER& w = *workers[target];
+            lock_guard<mutex> guard(w.lock);
+            w.local.enqueue(move(task), priority);
+        }
+        if (sleepers.load(memory_order_relaxed) > 0) {
+            lock_guard<mutex> guard(idleLock);
+            workCv.notify_one();
+        }
+    }
+
+
+    //
+    // wait:
+    //
+    // Blocks until every task spawned so far, and every task they spawn,
+    // has finished.  Must not be called from a worker thread.
+    //
+    void wait() {
+        unique_lock<mutex> guard(idleLock);
+        doneCv.wait(guard, [this]() {
+            return pending.load(memory_order_acquire) == 0;
+        });
+    }
+
+
+    //
+    // thread_count / steals:
+    //
+    size_t thread_count() const {
+        return workers.size();
+    }
+
+    size_t steals() const {
+        return nsteals.load(memory_order_relaxed);
+    }
+};